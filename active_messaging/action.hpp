@@ -7,19 +7,35 @@
 #if !defined(CPPNOW_BAA1C7EE_658B_42B8_900A_73FA5BBED365)
 #define CPPNOW_BAA1C7EE_658B_42B8_900A_73FA5BBED365
 
-struct runtime;
+#include "runtime_fwd.hpp"
 
-struct action
+/// The base of all actions which can be sent to a Runtime. Actions for the
+/// default runtime derive from action.
+template <typename Runtime>
+struct basic_action
 {
-    virtual ~action() {}
+    typedef basic_action action_type;
 
-    virtual void operator()(runtime&) = 0;
-    
-    virtual action* clone() const = 0;
+    virtual ~basic_action() {}
+
+    virtual void operator()(Runtime&) = 0;
+
+    virtual basic_action* clone() const = 0;
+
+    /// Actions which don't depend on where they run (they don't use objects
+    /// registered with the runtime, and only talk to other localities by
+    /// locality id) can return true. A load balancing runtime may then
+    /// execute them on a neighbouring locality instead.
+    virtual bool is_migratable() const
+    {
+        return false;
+    }
 
     template <typename Archive>
     void serialize(Archive& ar, const unsigned int) {}
 };
 
+typedef basic_action<runtime> action;
+
 #endif
 
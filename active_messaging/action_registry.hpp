@@ -0,0 +1,123 @@
+// Copyright (c) 2012-2013 Bryce Adelstein-Lelbach
+// Copyright (c) 2012-2013 Hartmut Kaiser
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+#if !defined(CPPNOW_BCCE881C_2DFC_4589_941D_BEB1F99A61CC)
+#define CPPNOW_BCCE881C_2DFC_4589_941D_BEB1F99A61CC
+
+#include <map>
+#include <stdexcept>
+#include <string>
+
+#include <boost/cstdint.hpp>
+#include <boost/preprocessor/cat.hpp>
+#include <boost/serialization/export.hpp>
+#include <boost/archive/binary_oarchive.hpp>
+#include <boost/archive/binary_iarchive.hpp>
+
+#include "action.hpp"
+#include "parcel.hpp"
+
+///////////////////////////////////////////////////////////////////////////////
+/// Saves and loads the body of one concrete action type. Compact parcels
+/// identify their type by the action id in the parcel header, so they are
+/// (de)serialized through one of these instead of through a polymorphic
+/// pointer, which would write the class name into every parcel.
+template <typename Base>
+struct basic_action_serializer
+{
+    virtual ~basic_action_serializer() {}
+
+    virtual void save(
+        boost::archive::binary_oarchive& ar
+      , Base const& act
+        ) const = 0;
+
+    virtual Base* load(boost::archive::binary_iarchive& ar) const = 0;
+};
+
+typedef basic_action_serializer<action> action_serializer;
+
+template <typename Action>
+struct action_serializer_impl
+  : basic_action_serializer<typename Action::action_type>
+{
+    typedef typename Action::action_type base_type;
+
+    void save(boost::archive::binary_oarchive& ar, base_type const& act) const
+    {
+        ar << static_cast<Action const&>(act);
+    }
+
+    base_type* load(boost::archive::binary_iarchive& ar) const
+    {
+        Action* act = new Action;
+        ar >> *act;
+        return act;
+    }
+};
+
+///////////////////////////////////////////////////////////////////////////////
+/// The serializers of all registered actions derived from Base, by action
+/// id. This is filled in during static initialization and only read
+/// afterwards.
+template <typename Base>
+inline std::map<boost::uint32_t, basic_action_serializer<Base> const*>&
+action_registry()
+{
+    static std::map<boost::uint32_t, basic_action_serializer<Base> const*>
+        registry;
+    return registry;
+}
+
+/// Returns the serializer for an action id, or 0 if it is not registered.
+template <typename Base>
+inline basic_action_serializer<Base> const*
+get_action_serializer(boost::uint32_t id)
+{
+    typedef std::map<boost::uint32_t, basic_action_serializer<Base> const*>
+        registry_type;
+
+    typename registry_type::const_iterator it
+        = action_registry<Base>().find(id);
+    return it != action_registry<Base>().end() ? it->second : 0;
+}
+
+template <typename Action>
+struct action_registration
+{
+    action_registration()
+    {
+        typedef typename Action::action_type base_type;
+
+        static action_serializer_impl<Action> const serializer;
+        char const* guid = boost::serialization::guid<Action>();
+        boost::uint32_t id = get_action_id(guid);
+
+        // Compact parcels only carry the id, so two actions with the same
+        // id would be mistaken for each other. Registration happens during
+        // static initialization, so this stops the program before it
+        // starts.
+        basic_action_serializer<base_type> const*& slot
+            = action_registry<base_type>()[id];
+
+        if (slot && slot != &serializer)
+            throw std::logic_error(std::string("action id collision: the "
+                "export GUID '") + (guid ? guid : "") + "' has the same id "
+                "as an action registered before it; change one of the GUIDs");
+
+        slot = &serializer;
+    }
+};
+
+/// Allows an exported action to be sent in compact parcels. Must appear after
+/// BOOST_CLASS_EXPORT_GUID for the same type.
+#define REGISTER_ACTION(T)                                                    \
+    static action_registration<T> const                                       \
+        BOOST_PP_CAT(action_registration_, __LINE__)                          \
+    /**/
+
+#endif
+
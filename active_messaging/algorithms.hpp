@@ -0,0 +1,958 @@
+// Copyright (c) 2012-2013 Bryce Adelstein-Lelbach
+// Copyright (c) 2012-2013 Hartmut Kaiser
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+#if !defined(CPPNOW_F10E363B_75A9_48D2_A011_428FB2A48855)
+#define CPPNOW_F10E363B_75A9_48D2_A011_428FB2A48855
+
+// Parallel algorithms over partitioned_vectors. Each one sends a request to
+// every locality holding a segment (the other localities first, so that they
+// work while we do our own share), processes each segment with all of the
+// threads given by algorithm_threads(), and gathers the results on the
+// calling locality.
+//
+// The functions passed to the algorithms are sent along with the requests,
+// so they must be serializable (a serialize member is enough, even if it
+// does nothing), and the actions carrying them must be registered with the
+// REGISTER_* macros below, once per program.
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <boost/preprocessor/cat.hpp>
+#include <boost/preprocessor/stringize.hpp>
+#include <boost/serialization/vector.hpp>
+
+#include "task.hpp"
+#include "future.hpp"
+#include "partitioned_vector.hpp"
+
+///////////////////////////////////////////////////////////////////////////////
+// Local parallelism.
+
+/// The number of threads each locality uses to process its segment.
+/// Defaults to the number of cores; lower it when several localities share
+/// a host.
+inline std::atomic<std::size_t>& algorithm_threads()
+{
+    static std::atomic<std::size_t> threads(
+        std::max(1u, std::thread::hardware_concurrency()));
+    return threads;
+}
+
+namespace detail
+{
+
+/// Segments smaller than this aren't worth starting a thread for.
+static const std::size_t min_chunk_size = 16 * 1024;
+
+/// The number of chunks to split n elements into.
+inline std::size_t chunks_for(std::size_t n)
+{
+    return std::max<std::size_t>(1
+      , std::min<std::size_t>(algorithm_threads().load(), n / min_chunk_size));
+}
+
+/// The first element of chunk c of n elements split into chunks.
+inline std::size_t chunk_begin(
+    std::size_t n
+  , std::size_t chunks
+  , std::size_t c
+    )
+{
+    return n * c / chunks;
+}
+
+/// The threads which run the chunks of the algorithms. They are started the
+/// first time they're needed, and shared by all the localities in the
+/// process until it exits.
+struct worker_pool
+{
+  private:
+    std::mutex mtx_;
+    std::condition_variable cond_;
+    std::deque<std::function<void()> > jobs_;
+    std::vector<std::thread> threads_;
+    bool stop_;
+
+  public:
+    worker_pool()
+      : mtx_()
+      , cond_()
+      , jobs_()
+      , threads_()
+      , stop_(false)
+    {}
+
+    ~worker_pool()
+    {
+        {
+            std::lock_guard<std::mutex> l(mtx_);
+            stop_ = true;
+        }
+
+        cond_.notify_all();
+
+        for (std::thread& t : threads_)
+            t.join();
+    }
+
+    static worker_pool& get()
+    {
+        static worker_pool pool;
+        return pool;
+    }
+
+    /// Runs job on one of the threads, first growing the pool to at least
+    /// threads of them.
+    void post(std::size_t threads, std::function<void()> job)
+    {
+        {
+            std::lock_guard<std::mutex> l(mtx_);
+
+            while (threads_.size() < threads)
+                threads_.emplace_back(&worker_pool::work, this);
+
+            jobs_.push_back(std::move(job));
+        }
+
+        cond_.notify_one();
+    }
+
+  private:
+    void work()
+    {
+        while (true)
+        {
+            std::function<void()> job;
+
+            {
+                std::unique_lock<std::mutex> l(mtx_);
+
+                while (!stop_ && jobs_.empty())
+                    cond_.wait(l);
+
+                if (jobs_.empty())
+                    return;
+
+                job.swap(jobs_.front());
+                jobs_.pop_front();
+            }
+
+            job();
+        }
+    }
+};
+
+/// Calls f(c) for each c in [0, count) on the worker pool, and returns once
+/// all the calls have. Called from a task (as actions are), the task is
+/// suspended meanwhile, so that the execution thread goes on running other
+/// parcels; otherwise, the calling thread runs f(0) itself and then blocks.
+template <typename F>
+void parallel_invoke(std::size_t count, F const& f)
+{
+    if (count <= 1)
+    {
+        if (count != 0)
+            f(0);
+        return;
+    }
+
+    std::size_t const first = task::current() ? 0 : 1;
+
+    // The last call to finish is the last one to touch anything on our
+    // stack; once it sets done, we may return.
+    std::atomic<std::size_t> remaining(count - first);
+    promise<void> done;
+
+    for (std::size_t c = first; c < count; ++c)
+        worker_pool::get().post(count,
+            [&f, &remaining, done, c]()
+            {
+                f(c);
+
+                if (--remaining == 0)
+                    done.set_value();
+            });
+
+    if (first != 0)
+        f(0);
+
+    done.get_future().get();
+}
+
+/// Merges the sorted runs [bounds[i], bounds[i + 1]) of v in place, pairs of
+/// runs at a time, in parallel.
+template <typename T>
+void merge_runs(std::vector<T>& v, std::vector<std::size_t> bounds)
+{
+    while (bounds.size() > 2)
+    {
+        std::size_t pairs = (bounds.size() - 1) / 2;
+
+        parallel_invoke(pairs,
+            [&v, &bounds](std::size_t p)
+            {
+                std::inplace_merge(v.begin() + bounds[2 * p]
+                                 , v.begin() + bounds[2 * p + 1]
+                                 , v.begin() + bounds[2 * p + 2]);
+            });
+
+        std::vector<std::size_t> merged;
+
+        for (std::size_t i = 0; i < bounds.size(); i += 2)
+            merged.push_back(bounds[i]);
+
+        if (merged.back() != bounds.back())
+            merged.push_back(bounds.back());
+
+        bounds.swap(merged);
+    }
+}
+
+/// Sorts v with all of our threads: each sorts a chunk, then the chunks are
+/// merged.
+template <typename T>
+void parallel_sort(std::vector<T>& v)
+{
+    std::size_t chunks = chunks_for(v.size());
+
+    std::vector<std::size_t> bounds;
+
+    for (std::size_t c = 0; c <= chunks; ++c)
+        bounds.push_back(chunk_begin(v.size(), chunks, c));
+
+    parallel_invoke(chunks,
+        [&v, &bounds](std::size_t c)
+        {
+            std::sort(v.begin() + bounds[c], v.begin() + bounds[c + 1]);
+        });
+
+    merge_runs(v, bounds);
+}
+
+template <typename T, typename Runtime>
+std::shared_ptr<segment<T> > get_segment(Runtime& rt, boost::uint64_t id)
+{
+    std::shared_ptr<segment<T> > s
+        = rt.template get_object<segment<T> >(id);
+    BOOST_ASSERT(s);
+    return s;
+}
+
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// generate
+
+/// Sets each element of a segment to g(i), where i is the index of the
+/// element in the whole vector.
+template <typename Runtime, typename T, typename G>
+struct generate_action : basic_action<Runtime>
+{
+  private:
+    boost::uint64_t id_;
+    boost::uint64_t offset_;
+    G g_;
+    reply_address reply_;
+
+  public:
+    generate_action()
+      : id_(0)
+      , offset_(0)
+      , g_()
+      , reply_()
+    {}
+
+    generate_action(
+        boost::uint64_t id
+      , boost::uint64_t offset
+      , G const& g
+      , reply_address const& reply_to
+        )
+      : id_(id)
+      , offset_(offset)
+      , g_(g)
+      , reply_(reply_to)
+    {}
+
+    void operator()(Runtime& rt)
+    {
+        std::shared_ptr<segment<T> > s = detail::get_segment<T>(rt, id_);
+
+        std::vector<T>& data = s->data;
+        std::size_t chunks = detail::chunks_for(data.size());
+
+        detail::parallel_invoke(chunks,
+            [this, &data, chunks](std::size_t c)
+            {
+                std::size_t first = detail::chunk_begin(data.size(), chunks
+                                                      , c);
+                std::size_t last = detail::chunk_begin(data.size(), chunks
+                                                     , c + 1);
+
+                for (std::size_t i = first; i < last; ++i)
+                    data[i] = g_(offset_ + i);
+            });
+
+        reply<generate_action>(rt, reply_, boost::uint64_t(data.size()));
+    }
+
+    basic_action<Runtime>* clone() const
+    {
+        return new generate_action(*this);
+    }
+
+    template <typename Archive>
+    void serialize(Archive& ar, const unsigned int)
+    {
+        ar & boost::serialization::base_object<basic_action<Runtime> >(*this);
+        ar & id_;
+        ar & offset_;
+        ar & g_;
+        ar & reply_;
+    }
+};
+
+/// Sets element i of v to g(i).
+template <typename Runtime, typename T, typename G>
+void generate(Runtime& rt, partitioned_vector<T> const& v, G const& g)
+{
+    typedef generate_action<Runtime, T, G> action_type;
+
+    std::vector<boost::uint64_t> const& sizes = v.get_sizes();
+
+    std::vector<boost::uint64_t> offsets(sizes.size(), 0);
+    for (std::size_t i = 1; i < sizes.size(); ++i)
+        offsets[i] = offsets[i - 1] + sizes[i - 1];
+
+    gather<Runtime, boost::uint64_t> done(rt, sizes.size());
+
+    for (std::size_t i : dispatch_order(rt, v))
+        rt.async_write(v.get_localities()[i]
+                     , action_type(v.get_id(), offsets[i], g
+                                 , done.address(i)));
+
+    done.get();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// for_each
+
+template <typename Runtime, typename T, typename F>
+struct for_each_action : basic_action<Runtime>
+{
+  private:
+    boost::uint64_t id_;
+    F f_;
+    reply_address reply_;
+
+  public:
+    for_each_action()
+      : id_(0)
+      , f_()
+      , reply_()
+    {}
+
+    for_each_action(
+        boost::uint64_t id
+      , F const& f
+      , reply_address const& reply_to
+        )
+      : id_(id)
+      , f_(f)
+      , reply_(reply_to)
+    {}
+
+    void operator()(Runtime& rt)
+    {
+        std::shared_ptr<segment<T> > s = detail::get_segment<T>(rt, id_);
+
+        std::vector<T>& data = s->data;
+        std::size_t chunks = detail::chunks_for(data.size());
+
+        detail::parallel_invoke(chunks,
+            [this, &data, chunks](std::size_t c)
+            {
+                std::for_each(
+                    data.begin() + detail::chunk_begin(data.size(), chunks, c)
+                  , data.begin() + detail::chunk_begin(data.size(), chunks
+                                                     , c + 1)
+                  , f_);
+            });
+
+        reply<for_each_action>(rt, reply_, boost::uint64_t(data.size()));
+    }
+
+    basic_action<Runtime>* clone() const
+    {
+        return new for_each_action(*this);
+    }
+
+    template <typename Archive>
+    void serialize(Archive& ar, const unsigned int)
+    {
+        ar & boost::serialization::base_object<basic_action<Runtime> >(*this);
+        ar & id_;
+        ar & f_;
+        ar & reply_;
+    }
+};
+
+/// Calls f on every element of v, in no particular order. f may be called
+/// concurrently.
+template <typename Runtime, typename T, typename F>
+void for_each(Runtime& rt, partitioned_vector<T> const& v, F const& f)
+{
+    typedef for_each_action<Runtime, T, F> action_type;
+
+    gather<Runtime, boost::uint64_t> done(rt, v.get_localities().size());
+
+    for (std::size_t i : dispatch_order(rt, v))
+        rt.async_write(v.get_localities()[i]
+                     , action_type(v.get_id(), f, done.address(i)));
+
+    done.get();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// transform_reduce
+
+namespace detail
+{
+
+/// A reduction of some of the transformed elements, which is empty if there
+/// were none.
+template <typename V>
+struct partial_reduction
+{
+    V value;
+    bool empty;
+
+    partial_reduction()
+      : value()
+      , empty(true)
+    {}
+
+    template <typename Reduce>
+    void add(V const& v, Reduce const& reduce)
+    {
+        value = empty ? v : reduce(value, v);
+        empty = false;
+    }
+
+    template <typename Reduce>
+    void add(partial_reduction const& p, Reduce const& reduce)
+    {
+        if (!p.empty)
+            add(p.value, reduce);
+    }
+
+    template <typename Archive>
+    void serialize(Archive& ar, const unsigned int)
+    {
+        ar & value;
+        ar & empty;
+    }
+};
+
+}
+
+/// Reduces the transformed elements of a segment. Replies with an empty
+/// partial_reduction if the segment is empty.
+template <
+    typename Runtime
+  , typename T
+  , typename V
+  , typename Reduce
+  , typename Transform
+    >
+struct transform_reduce_action : basic_action<Runtime>
+{
+  private:
+    boost::uint64_t id_;
+    Reduce reduce_;
+    Transform transform_;
+    reply_address reply_;
+
+  public:
+    transform_reduce_action()
+      : id_(0)
+      , reduce_()
+      , transform_()
+      , reply_()
+    {}
+
+    transform_reduce_action(
+        boost::uint64_t id
+      , Reduce const& reduce
+      , Transform const& transform
+      , reply_address const& reply_to
+        )
+      : id_(id)
+      , reduce_(reduce)
+      , transform_(transform)
+      , reply_(reply_to)
+    {}
+
+    void operator()(Runtime& rt)
+    {
+        std::shared_ptr<segment<T> > s = detail::get_segment<T>(rt, id_);
+
+        std::vector<T> const& data = s->data;
+        std::size_t chunks = detail::chunks_for(data.size());
+
+        std::vector<detail::partial_reduction<V> > partials(chunks);
+
+        detail::parallel_invoke(chunks,
+            [this, &data, &partials, chunks](std::size_t c)
+            {
+                std::size_t first = detail::chunk_begin(data.size(), chunks
+                                                      , c);
+                std::size_t last = detail::chunk_begin(data.size(), chunks
+                                                     , c + 1);
+
+                detail::partial_reduction<V> r;
+
+                for (std::size_t i = first; i < last; ++i)
+                    r.add(transform_(data[i]), reduce_);
+
+                partials[c] = r;
+            });
+
+        detail::partial_reduction<V> result;
+
+        for (detail::partial_reduction<V> const& p : partials)
+            result.add(p, reduce_);
+
+        reply<transform_reduce_action>(rt, reply_, result);
+    }
+
+    basic_action<Runtime>* clone() const
+    {
+        return new transform_reduce_action(*this);
+    }
+
+    template <typename Archive>
+    void serialize(Archive& ar, const unsigned int)
+    {
+        ar & boost::serialization::base_object<basic_action<Runtime> >(*this);
+        ar & id_;
+        ar & reduce_;
+        ar & transform_;
+        ar & reply_;
+    }
+};
+
+/// Returns init reduced with transform(x) for every element x of v. reduce
+/// must be associative and commutative; the elements are reduced in no
+/// particular order.
+template <
+    typename Runtime
+  , typename T
+  , typename V
+  , typename Reduce
+  , typename Transform
+    >
+V transform_reduce(
+    Runtime& rt
+  , partitioned_vector<T> const& v
+  , V init
+  , Reduce const& reduce
+  , Transform const& transform
+    )
+{
+    typedef transform_reduce_action<Runtime, T, V, Reduce, Transform>
+        action_type;
+
+    gather<Runtime, detail::partial_reduction<V> >
+        partials(rt, v.get_localities().size());
+
+    for (std::size_t i : dispatch_order(rt, v))
+        rt.async_write(v.get_localities()[i]
+                     , action_type(v.get_id(), reduce, transform
+                                 , partials.address(i)));
+
+    for (detail::partial_reduction<V> const& p : partials.get())
+        if (!p.empty)
+            init = reduce(init, p.value);
+
+    return init;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// sort
+//
+// A sample sort. Every locality sorts its own segment and sends a sample of
+// it to the caller, which picks a splitter between each pair of segments.
+// Then every locality splits its segment at the splitters, and sends each
+// part to the segment it now belongs to. Each segment merges the (sorted)
+// parts it receives. Localities must be able to send parcels to each other,
+// directly or through routes.
+
+namespace detail
+{
+
+/// How many samples each segment sends, per segment.
+static const std::size_t sort_oversampling = 32;
+
+}
+
+/// Sorts a segment, and replies with a sample of it.
+template <typename Runtime, typename T>
+struct sort_sample_action : basic_action<Runtime>
+{
+  private:
+    boost::uint64_t id_;
+    boost::uint64_t samples_;
+    reply_address reply_;
+
+  public:
+    sort_sample_action()
+      : id_(0)
+      , samples_(0)
+      , reply_()
+    {}
+
+    sort_sample_action(
+        boost::uint64_t id
+      , boost::uint64_t samples
+      , reply_address const& reply_to
+        )
+      : id_(id)
+      , samples_(samples)
+      , reply_(reply_to)
+    {}
+
+    void operator()(Runtime& rt)
+    {
+        std::shared_ptr<segment<T> > s = detail::get_segment<T>(rt, id_);
+
+        std::vector<T> const& data = s->data;
+
+        detail::parallel_sort(s->data);
+
+        std::vector<T> sample;
+
+        if (data.size() <= samples_)
+            sample = data;
+
+        else
+            for (std::size_t k = 0; k < samples_; ++k)
+                sample.push_back(data[data.size() * (k + 1) / (samples_ + 1)]);
+
+        reply<sort_sample_action>(rt, reply_, sample);
+    }
+
+    basic_action<Runtime>* clone() const
+    {
+        return new sort_sample_action(*this);
+    }
+
+    template <typename Archive>
+    void serialize(Archive& ar, const unsigned int)
+    {
+        ar & boost::serialization::base_object<basic_action<Runtime> >(*this);
+        ar & id_;
+        ar & samples_;
+        ar & reply_;
+    }
+};
+
+/// Delivers the elements that one segment sent to another. Once a segment
+/// has heard from every segment, it merges what it received, and replies
+/// with its new size.
+template <typename Runtime, typename T>
+struct sort_bucket_action : basic_action<Runtime>
+{
+  private:
+    boost::uint64_t id_;
+    boost::uint64_t from_;
+    boost::uint64_t segments_;
+    std::vector<T> bucket_;
+    reply_address reply_;
+
+  public:
+    sort_bucket_action()
+      : id_(0)
+      , from_(0)
+      , segments_(0)
+      , bucket_()
+      , reply_()
+    {}
+
+    sort_bucket_action(
+        boost::uint64_t id
+      , boost::uint64_t from
+      , boost::uint64_t segments
+      , std::vector<T> const& bucket
+      , reply_address const& reply_to
+        )
+      : id_(id)
+      , from_(from)
+      , segments_(segments)
+      , bucket_(bucket)
+      , reply_(reply_to)
+    {}
+
+    void operator()(Runtime& rt)
+    {
+        std::shared_ptr<segment<T> > s = detail::get_segment<T>(rt, id_);
+
+        if (s->incoming.empty())
+            s->incoming.resize(segments_);
+
+        BOOST_ASSERT(from_ < s->incoming.size());
+        s->incoming[from_].swap(bucket_);
+
+        if (++s->received != segments_)
+            return;
+
+        // Our own bucket is only sent once we've split our old elements, so
+        // by now they're all accounted for.
+        std::vector<T> data;
+        std::vector<std::size_t> bounds(1, 0);
+
+        for (std::vector<T> const& b : s->incoming)
+        {
+            data.insert(data.end(), b.begin(), b.end());
+            bounds.push_back(data.size());
+        }
+
+        detail::merge_runs(data, bounds);
+
+        s->data.swap(data);
+        s->incoming.clear();
+        s->received = 0;
+
+        reply<sort_bucket_action>(rt, reply_
+                                , boost::uint64_t(s->data.size()));
+    }
+
+    basic_action<Runtime>* clone() const
+    {
+        return new sort_bucket_action(*this);
+    }
+
+    template <typename Archive>
+    void serialize(Archive& ar, const unsigned int)
+    {
+        ar & boost::serialization::base_object<basic_action<Runtime> >(*this);
+        ar & id_;
+        ar & from_;
+        ar & segments_;
+        ar & bucket_;
+        ar & reply_;
+    }
+};
+
+/// Splits a sorted segment at the splitters, and sends each part to the
+/// segment it belongs to.
+template <typename Runtime, typename T>
+struct sort_exchange_action : basic_action<Runtime>
+{
+  private:
+    boost::uint64_t id_;
+    boost::uint64_t index_;
+    std::vector<T> splitters_;
+    std::vector<boost::uint64_t> localities_;
+    reply_address reply_;
+
+  public:
+    sort_exchange_action()
+      : id_(0)
+      , index_(0)
+      , splitters_()
+      , localities_()
+      , reply_()
+    {}
+
+    /// Segment j replies to reply_to, with its index set to j.
+    sort_exchange_action(
+        boost::uint64_t id
+      , boost::uint64_t index
+      , std::vector<T> const& splitters
+      , std::vector<boost::uint64_t> const& localities
+      , reply_address const& reply_to
+        )
+      : id_(id)
+      , index_(index)
+      , splitters_(splitters)
+      , localities_(localities)
+      , reply_(reply_to)
+    {}
+
+    void operator()(Runtime& rt)
+    {
+        typedef sort_bucket_action<Runtime, T> bucket_action;
+
+        std::shared_ptr<segment<T> > s = detail::get_segment<T>(rt, id_);
+
+        std::vector<T> data;
+        data.swap(s->data);
+
+        typename std::vector<T>::const_iterator first = data.begin();
+
+        for (std::size_t j = 0; j < localities_.size(); ++j)
+        {
+            typename std::vector<T>::const_iterator last = data.end();
+
+            if (j < splitters_.size())
+                last = std::upper_bound(first, last, splitters_[j]);
+
+            reply_address to = reply_;
+            to.index = j;
+
+            rt.async_write(localities_[j]
+                         , bucket_action(id_, index_, localities_.size()
+                                       , std::vector<T>(first, last), to));
+
+            first = last;
+        }
+    }
+
+    basic_action<Runtime>* clone() const
+    {
+        return new sort_exchange_action(*this);
+    }
+
+    template <typename Archive>
+    void serialize(Archive& ar, const unsigned int)
+    {
+        ar & boost::serialization::base_object<basic_action<Runtime> >(*this);
+        ar & id_;
+        ar & index_;
+        ar & splitters_;
+        ar & localities_;
+        ar & reply_;
+    }
+};
+
+/// Sorts v (with operator<). Elements move between segments, so afterwards
+/// the segments generally have different sizes than before.
+template <typename Runtime, typename T>
+void sort(Runtime& rt, partitioned_vector<T>& v)
+{
+    std::vector<boost::uint64_t> const& localities = v.get_localities();
+    std::size_t n = localities.size();
+
+    std::vector<std::size_t> order = dispatch_order(rt, v);
+
+    // Sort each segment, and get samples of them.
+    std::vector<T> samples;
+
+    {
+        gather<Runtime, std::vector<T> > sampled(rt, n);
+
+        for (std::size_t i : order)
+            rt.async_write(localities[i]
+                         , sort_sample_action<Runtime, T>(v.get_id()
+                             , detail::sort_oversampling * n
+                             , sampled.address(i)));
+
+        for (std::vector<T> const& s : sampled.get())
+            samples.insert(samples.end(), s.begin(), s.end());
+    }
+
+    std::sort(samples.begin(), samples.end());
+
+    // Segment j gets the elements between splitters j - 1 and j.
+    std::vector<T> splitters;
+
+    if (!samples.empty())
+        for (std::size_t j = 1; j < n; ++j)
+            splitters.push_back(samples[samples.size() * j / n]);
+
+    // Exchange the elements.
+    gather<Runtime, boost::uint64_t> sizes(rt, n);
+
+    for (std::size_t i : order)
+        rt.async_write(localities[i]
+                     , sort_exchange_action<Runtime, T>(v.get_id(), i
+                         , splitters, localities, sizes.address(0)));
+
+    v.set_sizes(sizes.get());
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Registration, for the default runtime.
+
+#define REGISTER_GENERATE(T, G)                                               \
+    typedef generate_action<runtime, T, G>                                    \
+        BOOST_PP_CAT(generate_action_, __LINE__);                             \
+    REGISTER_ALGORITHM_ACTION(BOOST_PP_CAT(generate_action_, __LINE__)        \
+      , "generate_action<" BOOST_PP_STRINGIZE(T) ","                          \
+                           BOOST_PP_STRINGIZE(G) ">");                        \
+    typedef gather_action<runtime, boost::uint64_t                            \
+                        , BOOST_PP_CAT(generate_action_, __LINE__)>           \
+        BOOST_PP_CAT(generate_reply_, __LINE__);                              \
+    REGISTER_ALGORITHM_ACTION(BOOST_PP_CAT(generate_reply_, __LINE__)         \
+      , "generate_reply<" BOOST_PP_STRINGIZE(T) ","                           \
+                          BOOST_PP_STRINGIZE(G) ">")                          \
+    /**/
+
+#define REGISTER_FOR_EACH(T, F)                                               \
+    typedef for_each_action<runtime, T, F>                                    \
+        BOOST_PP_CAT(for_each_action_, __LINE__);                             \
+    REGISTER_ALGORITHM_ACTION(BOOST_PP_CAT(for_each_action_, __LINE__)        \
+      , "for_each_action<" BOOST_PP_STRINGIZE(T) ","                          \
+                           BOOST_PP_STRINGIZE(F) ">");                        \
+    typedef gather_action<runtime, boost::uint64_t                            \
+                        , BOOST_PP_CAT(for_each_action_, __LINE__)>           \
+        BOOST_PP_CAT(for_each_reply_, __LINE__);                              \
+    REGISTER_ALGORITHM_ACTION(BOOST_PP_CAT(for_each_reply_, __LINE__)         \
+      , "for_each_reply<" BOOST_PP_STRINGIZE(T) ","                           \
+                          BOOST_PP_STRINGIZE(F) ">")                          \
+    /**/
+
+#define REGISTER_TRANSFORM_REDUCE(T, V, Reduce, Transform)                    \
+    typedef transform_reduce_action<runtime, T, V, Reduce, Transform>         \
+        BOOST_PP_CAT(transform_reduce_action_, __LINE__);                     \
+    REGISTER_ALGORITHM_ACTION(BOOST_PP_CAT(transform_reduce_action_, __LINE__)\
+      , "transform_reduce_action<" BOOST_PP_STRINGIZE(T) ","                  \
+            BOOST_PP_STRINGIZE(V) "," BOOST_PP_STRINGIZE(Reduce) ","          \
+            BOOST_PP_STRINGIZE(Transform) ">");                               \
+    typedef gather_action<runtime, detail::partial_reduction<V>               \
+                        , BOOST_PP_CAT(transform_reduce_action_, __LINE__)>   \
+        BOOST_PP_CAT(transform_reduce_reply_, __LINE__);                      \
+    REGISTER_ALGORITHM_ACTION(BOOST_PP_CAT(transform_reduce_reply_, __LINE__) \
+      , "transform_reduce_reply<" BOOST_PP_STRINGIZE(T) ","                   \
+            BOOST_PP_STRINGIZE(V) "," BOOST_PP_STRINGIZE(Reduce) ","          \
+            BOOST_PP_STRINGIZE(Transform) ">")                                \
+    /**/
+
+#define REGISTER_SORT(T)                                                      \
+    typedef sort_sample_action<runtime, T>                                    \
+        BOOST_PP_CAT(sort_sample_action_, __LINE__);                          \
+    REGISTER_ALGORITHM_ACTION(BOOST_PP_CAT(sort_sample_action_, __LINE__)     \
+      , "sort_sample_action<" BOOST_PP_STRINGIZE(T) ">");                     \
+    typedef gather_action<runtime, std::vector<T>                             \
+                        , BOOST_PP_CAT(sort_sample_action_, __LINE__)>        \
+        BOOST_PP_CAT(sort_sample_reply_, __LINE__);                           \
+    REGISTER_ALGORITHM_ACTION(BOOST_PP_CAT(sort_sample_reply_, __LINE__)      \
+      , "sort_sample_reply<" BOOST_PP_STRINGIZE(T) ">");                      \
+    typedef sort_exchange_action<runtime, T>                                  \
+        BOOST_PP_CAT(sort_exchange_action_, __LINE__);                        \
+    REGISTER_ALGORITHM_ACTION(BOOST_PP_CAT(sort_exchange_action_, __LINE__)   \
+      , "sort_exchange_action<" BOOST_PP_STRINGIZE(T) ">");                   \
+    typedef sort_bucket_action<runtime, T>                                    \
+        BOOST_PP_CAT(sort_bucket_action_, __LINE__);                          \
+    REGISTER_ALGORITHM_ACTION(BOOST_PP_CAT(sort_bucket_action_, __LINE__)     \
+      , "sort_bucket_action<" BOOST_PP_STRINGIZE(T) ">");                     \
+    typedef gather_action<runtime, boost::uint64_t                            \
+                        , BOOST_PP_CAT(sort_bucket_action_, __LINE__)>        \
+        BOOST_PP_CAT(sort_bucket_reply_, __LINE__);                           \
+    REGISTER_ALGORITHM_ACTION(BOOST_PP_CAT(sort_bucket_reply_, __LINE__)      \
+      , "sort_bucket_reply<" BOOST_PP_STRINGIZE(T) ">")                       \
+    /**/
+
+#endif
+
@@ -0,0 +1,349 @@
+// Copyright (c) 2012-2013 Bryce Adelstein-Lelbach
+// Copyright (c) 2012-2013 Hartmut Kaiser
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+// Measures how the distributed algorithms scale with the number of
+// localities. For each n from 1 to --localities, n runtimes are created in
+// this process and connected to each other by loopback connections (or,
+// with --port, by TCP connections, with locality i listening on port + i),
+// and a partitioned_vector of --size elements, spread across all of them, is
+// generated, transformed, summed and sorted. The results are checked, and
+// the time of each algorithm is compared with the time it took on one
+// locality.
+//
+// All the localities share this machine's cores, so by default each one uses
+// an equal share of them; use --threads to change that. Each locality also
+// has an execution thread which spins while it's idle, so adding localities
+// only pays off with a core per execution thread to spare; with fewer, the
+// speedups mostly show what the localities cost each other.
+
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <string>
+
+#include <boost/program_options.hpp>
+#include <boost/archive/binary_oarchive.hpp>
+#include <boost/archive/binary_iarchive.hpp>
+
+#include "runtime.hpp"
+#include "algorithms.hpp"
+
+namespace po = boost::program_options;
+
+/// Element i of the vector: a well mixed function of i (splitmix64).
+struct mix
+{
+    boost::uint64_t operator()(boost::uint64_t i) const
+    {
+        boost::uint64_t z = i + 0x9E3779B97F4A7C15ULL;
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        return z ^ (z >> 31);
+    }
+
+    template <typename Archive>
+    void serialize(Archive&, const unsigned int) {}
+};
+
+/// Clears the high bits of an element, so that summing can't overflow.
+struct shift_right
+{
+    void operator()(boost::uint64_t& x) const
+    {
+        x >>= 24;
+    }
+
+    template <typename Archive>
+    void serialize(Archive&, const unsigned int) {}
+};
+
+struct plus
+{
+    boost::uint64_t operator()(boost::uint64_t a, boost::uint64_t b) const
+    {
+        return a + b;
+    }
+
+    template <typename Archive>
+    void serialize(Archive&, const unsigned int) {}
+};
+
+struct identity
+{
+    boost::uint64_t operator()(boost::uint64_t x) const
+    {
+        return x;
+    }
+
+    template <typename Archive>
+    void serialize(Archive&, const unsigned int) {}
+};
+
+REGISTER_PARTITIONED_VECTOR(boost::uint64_t);
+REGISTER_GENERATE(boost::uint64_t, mix);
+REGISTER_FOR_EACH(boost::uint64_t, shift_right);
+REGISTER_TRANSFORM_REDUCE(boost::uint64_t, boost::uint64_t, plus, identity);
+REGISTER_SORT(boost::uint64_t);
+
+enum
+{
+    generate_timer,
+    for_each_timer,
+    transform_reduce_timer,
+    sort_timer,
+    timers
+};
+
+char const* const timer_names[timers] =
+{
+    "generate", "for_each", "transform_reduce", "sort"
+};
+
+typedef std::chrono::high_resolution_clock clock_type;
+
+double seconds_since(clock_type::time_point start)
+{
+    std::chrono::duration<double> elapsed = clock_type::now() - start;
+    return elapsed.count();
+}
+
+/// Returns true if the elements of v, seen through the runtimes which hold
+/// its segments, are sorted and sum up to sum.
+bool check_sorted(
+    std::map<boost::uint64_t, runtime*> const& runtimes
+  , partitioned_vector<boost::uint64_t> const& v
+  , boost::uint64_t sum
+    )
+{
+    boost::uint64_t total = 0;
+    boost::uint64_t size = 0;
+    boost::uint64_t last = 0;
+
+    for (boost::uint64_t locality : v.get_localities())
+    {
+        std::shared_ptr<segment<boost::uint64_t> > s = runtimes.at(locality)
+            ->get_object<segment<boost::uint64_t> >(v.get_id());
+
+        if (!s)
+            return false;
+
+        for (boost::uint64_t x : s->data)
+        {
+            if (x < last)
+                return false;
+
+            last = x;
+            total += x;
+        }
+
+        size += s->data.size();
+    }
+
+    return total == sum && size == v.size();
+}
+
+/// Runs each algorithm runs times on n localities, and stores the best time
+/// of each in best. The localities are connected by TCP if port isn't 0.
+/// Returns false if any result was wrong.
+bool benchmark(
+    std::size_t n
+  , boost::uint64_t size
+  , std::size_t threads
+  , bool compact
+  , boost::uint16_t port
+  , boost::uint64_t runs
+  , double (&best)[timers]
+    )
+{
+    algorithm_threads().store(threads);
+
+    std::vector<std::shared_ptr<runtime> > rts;
+    std::vector<std::thread> rt_threads;
+    std::map<boost::uint64_t, runtime*> by_locality;
+
+    for (std::size_t i = 0; i < n; ++i)
+    {
+        rts.emplace_back(new runtime(port ? std::to_string(port + i) : ""));
+        rts.back()->set_compact_parcels(compact);
+        by_locality[rts.back()->get_locality_id()] = rts.back().get();
+    }
+
+    for (std::size_t i = 0; i < n; ++i)
+    {
+        rts[i]->start();
+        rt_threads.emplace_back(boost::bind(&runtime::run, rts[i].get()));
+    }
+
+    // The sort sends elements from every locality to every other one.
+    for (std::size_t i = 0; i < n; ++i)
+        for (std::size_t j = i + 1; j < n; ++j)
+        {
+            if (port)
+                rts[i]->connect("localhost", std::to_string(port + j));
+            else
+                rts[i]->connect(*rts[j]);
+        }
+
+    // The accepting side of a TCP connection learns who connected to it
+    // asynchronously, so wait until every locality knows all the others.
+    for (std::size_t i = 0; i < n; ++i)
+        while (rts[i]->get_connections().size() < n - 1)
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+    runtime& rt = *rts[0];
+    bool ok = true;
+
+    for (boost::uint64_t r = 0; r < runs; ++r)
+    {
+        partitioned_vector<boost::uint64_t> v
+            = make_partitioned_vector<boost::uint64_t>(rt, all_localities(rt)
+                                                     , size);
+
+        double seconds[timers];
+
+        clock_type::time_point start = clock_type::now();
+        generate(rt, v, mix());
+        seconds[generate_timer] = seconds_since(start);
+
+        start = clock_type::now();
+        for_each(rt, v, shift_right());
+        seconds[for_each_timer] = seconds_since(start);
+
+        start = clock_type::now();
+        boost::uint64_t sum = transform_reduce(rt, v, boost::uint64_t(0)
+                                             , plus(), identity());
+        seconds[transform_reduce_timer] = seconds_since(start);
+
+        start = clock_type::now();
+        sort(rt, v);
+        seconds[sort_timer] = seconds_since(start);
+
+        // The sum of the first size elements, computed directly.
+        boost::uint64_t expected = 0;
+        for (boost::uint64_t i = 0; i < size; ++i)
+            expected += mix()(i) >> 24;
+
+        ok = ok && sum == expected && check_sorted(by_locality, v, sum);
+
+        for (std::size_t t = 0; t < timers; ++t)
+            if (r == 0 || seconds[t] < best[t])
+                best[t] = seconds[t];
+
+        destroy(rt, v);
+    }
+
+    for (std::size_t i = 0; i < n; ++i)
+        rts[i]->stop();
+
+    for (std::thread& t : rt_threads)
+        t.join();
+
+    return ok;
+}
+
+int main(int argc, char** argv)
+{
+    // Parse command line.
+    po::variables_map vm;
+
+    po::options_description
+        cmdline("Usage: algorithms_benchmark [--localities <n>] [--size <n>]"
+                " [--threads <n>] [--runs <n>] [--compact-parcels]"
+                " [--port <port>]");
+
+    cmdline.add_options()
+        ( "help,h"
+        , "print out program usage (this message)")
+
+        ( "localities"
+        , po::value<std::size_t>()->default_value(4)
+        , "run with 1 up to this many localities")
+
+        ( "size"
+        , po::value<boost::uint64_t>()->default_value(1 << 22)
+        , "number of elements in the vector")
+
+        ( "threads"
+        , po::value<std::size_t>()
+        , "threads per locality (default: the cores divided evenly between "
+          "the localities)")
+
+        ( "runs"
+        , po::value<boost::uint64_t>()->default_value(3)
+        , "number of runs per number of localities (the best one is "
+          "reported)")
+
+        ( "compact-parcels"
+        , "send parcels without per-parcel archive headers")
+
+        ( "port"
+        , po::value<boost::uint16_t>()
+        , "connect the localities by TCP, listening on this port and the "
+          "ones after it")
+    ;
+
+    po::store(po::command_line_parser(argc, argv).options(cmdline).run(), vm);
+
+    po::notify(vm);
+
+    // Print help screen.
+    if (vm.count("help"))
+    {
+        std::cout << cmdline;
+        return 1;
+    }
+
+    std::size_t localities = std::max<std::size_t>(1
+                               , vm["localities"].as<std::size_t>());
+    boost::uint64_t size = vm["size"].as<boost::uint64_t>();
+    boost::uint64_t runs = std::max<boost::uint64_t>(1
+                             , vm["runs"].as<boost::uint64_t>());
+    bool compact = vm.count("compact-parcels") != 0;
+    boost::uint16_t port = vm.count("port") ? vm["port"].as<boost::uint16_t>()
+                                            : 0;
+
+    std::size_t cores = std::max(1u, std::thread::hardware_concurrency());
+
+    std::cout << std::setw(10) << "localities" << std::setw(9) << "threads";
+    for (std::size_t t = 0; t < timers; ++t)
+        std::cout << std::setw(18) << timer_names[t];
+    std::cout << "\n";
+
+    double baseline[timers];
+    bool ok = true;
+
+    for (std::size_t n = 1; n <= localities; ++n)
+    {
+        std::size_t threads = vm.count("threads")
+                            ? vm["threads"].as<std::size_t>()
+                            : std::max<std::size_t>(1, cores / n);
+
+        double best[timers];
+
+        if (!benchmark(n, size, std::max<std::size_t>(1, threads), compact
+                     , port, runs, best))
+        {
+            std::cout << "wrong results with " << n << " localities\n";
+            ok = false;
+        }
+
+        if (n == 1)
+            std::copy(best, best + timers, baseline);
+
+        // Milliseconds, and speedup over one locality.
+        std::cout << std::setw(10) << n << std::setw(9) << threads;
+        for (std::size_t t = 0; t < timers; ++t)
+            std::cout << std::setw(10) << std::fixed << std::setprecision(1)
+                      << (best[t] * 1e3) << "ms"
+                      << std::setw(5) << std::setprecision(2)
+                      << (baseline[t] / best[t]) << "x";
+        std::cout << "\n";
+    }
+
+    return ok ? 0 : 1;
+}
+
@@ -0,0 +1,360 @@
+// Copyright (c) 2012-2013 Bryce Adelstein-Lelbach
+// Copyright (c) 2012-2013 Hartmut Kaiser
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+// Measures what load balancing does for a skewed workload. A client locality
+// sends --tasks migratable actions, each taking --work microseconds, to
+// --localities worker localities in this process; --skew of them go to the
+// first worker, and the rest are spread evenly. The makespan (the time from
+// sending the first task until the last one has finished) is measured with
+// and without load balancing between the workers.
+//
+// By default, tasks spin for their duration. With --sleep, they sleep
+// instead, which models tasks that wait on something other than the CPU (and
+// shows the effect of balancing even when the workers share fewer cores than
+// there are workers).
+//
+// The localities are connected by loopback connections, or with --port, by
+// TCP connections, with the client listening on port and worker i on
+// port + 1 + i. Over TCP, load reports, steal requests and migrated parcels
+// share each connection with the tasks themselves.
+
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <string>
+
+#include <boost/program_options.hpp>
+#include <boost/serialization/export.hpp>
+#include <boost/serialization/tracking.hpp>
+#include <boost/serialization/base_object.hpp>
+#include <boost/archive/binary_oarchive.hpp>
+#include <boost/archive/binary_iarchive.hpp>
+
+#include "runtime.hpp"
+#include "action_registry.hpp"
+
+namespace po = boost::program_options;
+
+std::atomic<boost::uint64_t> completed(0);
+
+// The number of tasks each worker executed, by locality id.
+std::mutex executed_mtx;
+std::map<boost::uint64_t, boost::uint64_t> executed;
+
+struct work_action : action
+{
+  private:
+    boost::uint64_t microseconds_;
+    bool sleep_;
+
+  public:
+    work_action()
+      : microseconds_(0)
+      , sleep_(false)
+    {}
+
+    work_action(boost::uint64_t microseconds, bool sleep)
+      : microseconds_(microseconds)
+      , sleep_(sleep)
+    {}
+
+    void operator()(runtime& rt)
+    {
+        std::chrono::microseconds duration(microseconds_);
+
+        if (sleep_)
+            std::this_thread::sleep_for(duration);
+
+        else
+        {
+            std::chrono::steady_clock::time_point end
+                = std::chrono::steady_clock::now() + duration;
+
+            while (std::chrono::steady_clock::now() < end)
+                ;
+        }
+
+        {
+            std::lock_guard<std::mutex> l(executed_mtx);
+            ++executed[rt.get_locality_id()];
+        }
+
+        ++completed;
+    }
+
+    action* clone() const
+    {
+        return new work_action(*this);
+    }
+
+    bool is_migratable() const
+    {
+        return true;
+    }
+
+    template <typename Archive>
+    void serialize(Archive& ar, const unsigned int)
+    {
+        ar & boost::serialization::base_object<action>(*this);
+        ar & microseconds_;
+        ar & sleep_;
+    }
+};
+
+BOOST_CLASS_EXPORT_GUID(work_action, "work_action");
+BOOST_CLASS_TRACKING(work_action, boost::serialization::track_never);
+REGISTER_ACTION(work_action);
+
+struct options
+{
+    std::size_t localities;
+    boost::uint64_t tasks;
+    boost::uint64_t work;
+    double skew;
+    bool sleep;
+    bool compact;
+    boost::uint16_t port;
+};
+
+/// Returns the makespan in seconds, and the number of migrated parcels and
+/// the share of the tasks executed by each worker in migrated and shares.
+double run_once(
+    options const& opts
+  , bool balance
+  , boost::uint64_t& migrated
+  , std::vector<double>& shares
+    )
+{
+    completed.store(0);
+    executed.clear();
+
+    // With TCP, the client listens on port and worker i on port + 1 + i.
+    auto port_of = [&opts](std::size_t i)
+    {
+        return opts.port ? std::to_string(opts.port + i) : std::string();
+    };
+
+    runtime client(port_of(0));
+    client.set_compact_parcels(opts.compact);
+
+    std::vector<std::shared_ptr<runtime> > workers;
+
+    for (std::size_t i = 0; i < opts.localities; ++i)
+    {
+        workers.emplace_back(new runtime(port_of(1 + i)));
+        workers.back()->set_compact_parcels(opts.compact);
+        workers.back()->set_load_balancing(balance);
+    }
+
+    std::vector<std::thread> threads;
+
+    client.start();
+    threads.emplace_back(boost::bind(&runtime::run, &client));
+
+    for (std::shared_ptr<runtime> const& w : workers)
+    {
+        w->start();
+        threads.emplace_back(boost::bind(&runtime::run, w.get()));
+    }
+
+    for (std::size_t i = 0; i < workers.size(); ++i)
+    {
+        if (opts.port)
+            client.connect("localhost", port_of(1 + i));
+        else
+            client.connect(*workers[i]);
+
+        for (std::size_t j = i + 1; j < workers.size(); ++j)
+        {
+            if (opts.port)
+                workers[i]->connect("localhost", port_of(1 + j));
+            else
+                workers[i]->connect(*workers[j]);
+        }
+    }
+
+    // The accepting side of a TCP connection learns who connected to it
+    // asynchronously; each worker has the client and the other workers as
+    // neighbours.
+    for (std::shared_ptr<runtime> const& w : workers)
+        while (w->get_connections().size() < workers.size())
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+    // Give the workers time to hear from each other.
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+
+    // The first skew * tasks tasks go to the first worker, and the rest
+    // round-robin to all of them.
+    boost::uint64_t skewed = boost::uint64_t(opts.skew * opts.tasks);
+
+    std::chrono::steady_clock::time_point start
+        = std::chrono::steady_clock::now();
+
+    for (boost::uint64_t t = 0; t < opts.tasks; ++t)
+    {
+        std::size_t w = t < skewed ? 0 : t % workers.size();
+
+        client.async_write(workers[w]->get_locality_id()
+                         , work_action(opts.work, opts.sleep));
+    }
+
+    while (completed.load() < opts.tasks)
+        std::this_thread::sleep_for(std::chrono::microseconds(50));
+
+    std::chrono::duration<double> makespan
+        = std::chrono::steady_clock::now() - start;
+
+    migrated = 0;
+    shares.clear();
+
+    for (std::shared_ptr<runtime> const& w : workers)
+    {
+        migrated += w->get_parcels_migrated();
+        shares.push_back(double(executed[w->get_locality_id()]) / opts.tasks);
+    }
+
+    client.stop();
+    for (std::shared_ptr<runtime> const& w : workers)
+        w->stop();
+
+    for (std::thread& t : threads)
+        t.join();
+
+    return makespan.count();
+}
+
+/// Prints the best of runs runs, and returns its makespan.
+double benchmark(
+    char const* name
+  , options const& opts
+  , bool balance
+  , boost::uint64_t runs
+  , double baseline
+    )
+{
+    double best = 0;
+    boost::uint64_t best_migrated = 0;
+    std::vector<double> best_shares;
+
+    for (boost::uint64_t i = 0; i < runs; ++i)
+    {
+        boost::uint64_t migrated = 0;
+        std::vector<double> shares;
+
+        double seconds = run_once(opts, balance, migrated, shares);
+
+        if (i == 0 || seconds < best)
+        {
+            best = seconds;
+            best_migrated = migrated;
+            best_shares = shares;
+        }
+    }
+
+    std::cout << std::left << std::setw(14) << name << std::right
+              << std::setw(12) << std::fixed << std::setprecision(1)
+              << (best * 1e3)
+              << std::setw(10) << std::setprecision(2)
+              << (baseline != 0 ? baseline / best : 1.0) << "x"
+              << std::setw(10) << best_migrated << "   ";
+
+    for (double s : best_shares)
+        std::cout << " " << std::setw(5) << std::setprecision(1)
+                  << (s * 100) << "%";
+
+    std::cout << "\n";
+
+    return best;
+}
+
+int main(int argc, char** argv)
+{
+    // Parse command line.
+    po::variables_map vm;
+
+    po::options_description
+        cmdline("Usage: balance_benchmark [--localities <n>] [--tasks <n>]"
+                " [--work <us>] [--skew <fraction>] [--sleep] [--runs <n>]"
+                " [--compact-parcels] [--port <port>]");
+
+    cmdline.add_options()
+        ( "help,h"
+        , "print out program usage (this message)")
+
+        ( "localities"
+        , po::value<std::size_t>()->default_value(4)
+        , "number of worker localities")
+
+        ( "tasks"
+        , po::value<boost::uint64_t>()->default_value(2000)
+        , "number of tasks to send")
+
+        ( "work"
+        , po::value<boost::uint64_t>()->default_value(200)
+        , "duration of each task, in microseconds")
+
+        ( "skew"
+        , po::value<double>()->default_value(0.9)
+        , "fraction of the tasks which are sent to the first worker")
+
+        ( "sleep"
+        , "tasks sleep instead of spinning")
+
+        ( "runs"
+        , po::value<boost::uint64_t>()->default_value(3)
+        , "number of runs per configuration (the best one is reported)")
+
+        ( "compact-parcels"
+        , "send parcels without per-parcel archive headers")
+
+        ( "port"
+        , po::value<boost::uint16_t>()
+        , "connect the localities by TCP, listening on this port and the "
+          "ones after it")
+    ;
+
+    po::store(po::command_line_parser(argc, argv).options(cmdline).run(), vm);
+
+    po::notify(vm);
+
+    // Print help screen.
+    if (vm.count("help"))
+    {
+        std::cout << cmdline;
+        return 1;
+    }
+
+    options opts;
+    opts.localities = std::max<std::size_t>(1
+                        , vm["localities"].as<std::size_t>());
+    opts.tasks = std::max<boost::uint64_t>(1
+                   , vm["tasks"].as<boost::uint64_t>());
+    opts.work = vm["work"].as<boost::uint64_t>();
+    opts.skew = std::min(1.0, std::max(0.0, vm["skew"].as<double>()));
+    opts.sleep = vm.count("sleep") != 0;
+    opts.compact = vm.count("compact-parcels") != 0;
+    opts.port = vm.count("port") ? vm["port"].as<boost::uint16_t>() : 0;
+
+    boost::uint64_t runs = std::max<boost::uint64_t>(1
+                             , vm["runs"].as<boost::uint64_t>());
+
+    // The makespan if the work were spread perfectly.
+    std::cout << "ideal makespan: " << std::fixed << std::setprecision(1)
+              << (1e-3 * opts.tasks * opts.work / opts.localities) << "ms\n";
+
+    std::cout << std::left << std::setw(14) << "balancing" << std::right
+              << std::setw(12) << "makespan ms"
+              << std::setw(11) << "speedup"
+              << std::setw(10) << "migrated"
+              << "    tasks per worker\n";
+
+    double baseline = benchmark("off", opts, false, runs, 0);
+
+    benchmark("on", opts, true, runs, baseline);
+
+    return 0;
+}
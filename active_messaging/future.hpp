@@ -0,0 +1,226 @@
+// Copyright (c) 2012-2013 Bryce Adelstein-Lelbach
+// Copyright (c) 2012-2013 Hartmut Kaiser
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+#if !defined(CPPNOW_090E3866_DE3B_4D3B_AB21_26FE916B3941)
+#define CPPNOW_090E3866_DE3B_4D3B_AB21_26FE916B3941
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <boost/assert.hpp>
+
+#include "task.hpp"
+
+namespace detail
+{
+
+template <typename T>
+struct future_state
+{
+  private:
+    std::mutex mtx_;
+    std::condition_variable cond_;
+
+    bool ready_;
+    T value_;
+
+    // The tasks that are suspended waiting on us. Futures are handles, so
+    // several tasks may wait on the same state.
+    std::vector<task*> waiters_;
+
+  public:
+    future_state()
+      : mtx_()
+      , cond_()
+      , ready_(false)
+      , value_()
+      , waiters_()
+    {}
+
+    void set_value(T const& v)
+    {
+        std::vector<task*> waiters;
+
+        {
+            std::lock_guard<std::mutex> l(mtx_);
+            BOOST_ASSERT(!ready_);
+            value_ = v;
+            ready_ = true;
+            waiters.swap(waiters_);
+        }
+
+        cond_.notify_all();
+
+        for (task* waiter : waiters)
+            waiter->get_scheduler().resume(waiter);
+    }
+
+    bool is_ready()
+    {
+        std::lock_guard<std::mutex> l(mtx_);
+        return ready_;
+    }
+
+    T const& get()
+    {
+        task* self = task::current();
+
+        if (self)
+        {
+            // We're in a task, so instead of blocking the OS thread we
+            // suspend and let the runtime run other tasks. The registration
+            // happens after we've switched off of our stack, so that a
+            // concurrent set_value can't resume us before we've suspended.
+            self->get_scheduler().suspend(
+                [this](task* t)
+                {
+                    std::unique_lock<std::mutex> l(mtx_);
+                    if (ready_)
+                    {
+                        l.unlock();
+                        t->get_scheduler().resume(t);
+                    }
+                    else
+                        waiters_.push_back(t);
+                });
+        }
+
+        else
+        {
+            std::unique_lock<std::mutex> l(mtx_);
+            while (!ready_)
+                cond_.wait(l);
+        }
+
+        BOOST_ASSERT(ready_);
+        return value_;
+    }
+};
+
+struct void_value {};
+
+}
+
+template <typename T>
+struct future
+{
+  private:
+    std::shared_ptr<detail::future_state<T> > state_;
+
+  public:
+    future()
+      : state_()
+    {}
+
+    explicit future(std::shared_ptr<detail::future_state<T> > const& state)
+      : state_(state)
+    {}
+
+    bool valid() const
+    {
+        return bool(state_);
+    }
+
+    bool is_ready() const
+    {
+        BOOST_ASSERT(state_);
+        return state_->is_ready();
+    }
+
+    /// Wait for the value. If called from inside a task, only the task is
+    /// suspended; the execution thread keeps running other work.
+    T const& get() const
+    {
+        BOOST_ASSERT(state_);
+        return state_->get();
+    }
+};
+
+template <>
+struct future<void>
+{
+  private:
+    std::shared_ptr<detail::future_state<detail::void_value> > state_;
+
+  public:
+    future()
+      : state_()
+    {}
+
+    explicit future(
+        std::shared_ptr<detail::future_state<detail::void_value> > const& state
+        )
+      : state_(state)
+    {}
+
+    bool valid() const
+    {
+        return bool(state_);
+    }
+
+    bool is_ready() const
+    {
+        BOOST_ASSERT(state_);
+        return state_->is_ready();
+    }
+
+    /// Wait for the value. If called from inside a task, only the task is
+    /// suspended; the execution thread keeps running other work.
+    void get() const
+    {
+        BOOST_ASSERT(state_);
+        state_->get();
+    }
+};
+
+template <typename T>
+struct promise
+{
+  private:
+    std::shared_ptr<detail::future_state<T> > state_;
+
+  public:
+    promise()
+      : state_(new detail::future_state<T>())
+    {}
+
+    future<T> get_future() const
+    {
+        return future<T>(state_);
+    }
+
+    void set_value(T const& v) const
+    {
+        state_->set_value(v);
+    }
+};
+
+template <>
+struct promise<void>
+{
+  private:
+    std::shared_ptr<detail::future_state<detail::void_value> > state_;
+
+  public:
+    promise()
+      : state_(new detail::future_state<detail::void_value>())
+    {}
+
+    future<void> get_future() const
+    {
+        return future<void>(state_);
+    }
+
+    void set_value() const
+    {
+        state_->set_value(detail::void_value());
+    }
+};
+
+#endif
+
@@ -0,0 +1,177 @@
+// Copyright (c) 2012-2013 Bryce Adelstein-Lelbach
+// Copyright (c) 2012-2013 Hartmut Kaiser
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+#if !defined(CPPNOW_0B7EFF64_4A28_487F_B9A7_2F2668C4988B)
+#define CPPNOW_0B7EFF64_4A28_487F_B9A7_2F2668C4988B
+
+#include <memory>
+#include <vector>
+
+#include <boost/assert.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/preprocessor/cat.hpp>
+#include <boost/serialization/export.hpp>
+#include <boost/serialization/tracking.hpp>
+#include <boost/serialization/base_object.hpp>
+
+#include "runtime.hpp"
+#include "future.hpp"
+#include "action_registry.hpp"
+
+///////////////////////////////////////////////////////////////////////////////
+/// Where a reply should go: a slot of a gather on some locality.
+struct reply_address
+{
+    boost::uint64_t locality;
+    boost::uint64_t gather;
+    boost::uint64_t index;
+
+    template <typename Archive>
+    void serialize(Archive& ar, const unsigned int)
+    {
+        ar & locality;
+        ar & gather;
+        ar & index;
+    }
+};
+
+namespace detail
+{
+
+template <typename T>
+struct gather_state
+{
+    std::vector<T> values;
+    std::size_t remaining;
+    promise<void> ready;
+};
+
+}
+
+/// Delivers one value to a gather. Tag only serves to make the replies of
+/// different requests different types, so that each can be exported along
+/// with its request.
+template <typename Runtime, typename T, typename Tag>
+struct gather_action : basic_action<Runtime>
+{
+  private:
+    boost::uint64_t gather_;
+    boost::uint64_t index_;
+    T value_;
+
+  public:
+    gather_action()
+      : gather_(0)
+      , index_(0)
+      , value_()
+    {}
+
+    gather_action(reply_address const& to, T const& value)
+      : gather_(to.gather)
+      , index_(to.index)
+      , value_(value)
+    {}
+
+    void operator()(Runtime& rt)
+    {
+        std::shared_ptr<detail::gather_state<T> > g
+            = rt.template get_object<detail::gather_state<T> >(gather_);
+
+        // The gather was destroyed before every reply arrived (e.g. its
+        // caller unwound on an exception); nobody wants this one any more.
+        if (!g)
+            return;
+
+        BOOST_ASSERT(index_ < g->values.size());
+
+        std::swap(g->values[index_], value_);
+
+        // Replies are only executed by our execution thread, so this needs
+        // no synchronization.
+        if (--g->remaining == 0)
+            g->ready.set_value();
+    }
+
+    basic_action<Runtime>* clone() const
+    {
+        return new gather_action(*this);
+    }
+
+    template <typename Archive>
+    void serialize(Archive& ar, const unsigned int)
+    {
+        ar & boost::serialization::base_object<basic_action<Runtime> >(*this);
+        ar & gather_;
+        ar & index_;
+        ar & value_;
+    }
+};
+
+/// Collects one value from each of n requests sent to other localities (or
+/// to this one). Each request carries an address(i) to reply to, and replies
+/// with reply().
+template <typename Runtime, typename T>
+struct gather
+{
+  private:
+    Runtime& runtime_;
+    boost::uint64_t id_;
+    std::shared_ptr<detail::gather_state<T> > state_;
+
+  public:
+    gather(Runtime& rt, std::size_t n)
+      : runtime_(rt)
+      , id_(rt.new_object_id())
+      , state_(new detail::gather_state<T>())
+    {
+        state_->values.resize(n);
+        state_->remaining = n;
+
+        if (n == 0)
+            state_->ready.set_value();
+
+        runtime_.register_object(id_, state_);
+    }
+
+    ~gather()
+    {
+        runtime_.unregister_object(id_);
+    }
+
+    reply_address address(std::size_t index) const
+    {
+        reply_address a = { runtime_.get_locality_id(), id_, index };
+        return a;
+    }
+
+    /// Wait for all the values, by index. If called from a task, only the
+    /// task is suspended.
+    std::vector<T>& get()
+    {
+        state_->ready.get_future().get();
+        return state_->values;
+    }
+};
+
+/// Send value to the gather slot at to, as a reply to a request of type Tag.
+template <typename Tag, typename Runtime, typename T>
+void reply(Runtime& rt, reply_address const& to, T const& value)
+{
+    rt.async_write(to.locality, gather_action<Runtime, T, Tag>(to, value));
+}
+
+/// Exports an action used by the distributed algorithms, and registers it
+/// for compact parcels. name must be a typedef of the action, unique in the
+/// translation unit.
+#define REGISTER_ALGORITHM_ACTION(name, guid)                                 \
+    BOOST_CLASS_EXPORT_GUID(name, guid);                                      \
+    BOOST_CLASS_TRACKING(name, boost::serialization::track_never);            \
+    static action_registration<name> const                                    \
+        BOOST_PP_CAT(name, _registration)                                     \
+    /**/
+
+#endif
+
@@ -5,6 +5,7 @@
 // Distributed under the Boost Software License, Version 1.0. (See accompanying
 // file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
 
+#include <iostream>
 #include <condition_variable>
 
 #include <boost/scoped_ptr.hpp>
@@ -16,6 +17,8 @@
 #include <boost/archive/binary_iarchive.hpp>
 
 #include "runtime.hpp"
+#include "future.hpp"
+#include "action_registry.hpp"
 
 namespace po = boost::program_options;
 
@@ -42,6 +45,7 @@ struct hello_world_action : action
 
 BOOST_CLASS_EXPORT_GUID(hello_world_action, "hello_world_action");
 BOOST_CLASS_TRACKING(hello_world_action, boost::serialization::track_never);
+REGISTER_ACTION(hello_world_action);
 
 void hello_world_main(runtime& rt)
 {
@@ -49,15 +53,30 @@ void hello_world_main(runtime& rt)
 
     auto conns = rt.get_connections();
 
-    std::shared_ptr<boost::uint64_t> count(new boost::uint64_t(conns.size()));
+    std::vector<future<void> > sent;
 
     for (auto node : conns) 
+    {
+        promise<void> p;
+        sent.push_back(p.get_future());
+
         node.second->async_write(t,
-            [count,&rt](error_code const& ec)
+            [p](error_code const& ec)
             {
-                if (--(*count) == 0)
-                    rt.stop();
+                if (ec)
+                    std::cerr << "hello_world: write failed: "
+                              << ec.message() << "\n";
+
+                p.set_value();
             });
+    }
+
+    // Each get() suspends this task (not the execution thread) until the
+    // corresponding write has completed.
+    for (future<void> const& f : sent)
+        f.get();
+
+    rt.stop();
 }
 
 int main(int argc, char** argv)
@@ -67,7 +86,8 @@ int main(int argc, char** argv)
 
     po::options_description
         cmdline("Usage: hello_world --port <port> "
-                " [--remote-host <hostname> --remote-port <port>]");
+                " [--remote-host <hostname> --remote-port <port>]"
+                " [--compact-parcels]");
 
     cmdline.add_options()
         ( "help,h"
@@ -84,6 +104,9 @@ int main(int argc, char** argv)
         ( "remote-port"
         , po::value<std::string>()
         , "TCP port to connect to")
+
+        ( "compact-parcels"
+        , "offer to send parcels without per-parcel archive headers")
     ;
 
     po::store(po::command_line_parser(argc, argv).options(cmdline).run(), vm);
@@ -105,6 +128,8 @@ int main(int argc, char** argv)
     {
         rt.reset(new runtime(port));
 
+        rt->set_compact_parcels(vm.count("compact-parcels") != 0);
+
         std::cout << "Running as client, will not execute hello_world_main\n";
 
         std::string remote_host = "localhost", remote_port = port;
@@ -122,6 +147,8 @@ int main(int argc, char** argv)
     {
         rt.reset(new runtime(port, hello_world_main));
 
+        rt->set_compact_parcels(vm.count("compact-parcels") != 0);
+
         std::cout << "Running as server, will execute hello_world_main\n";
     }
 
@@ -0,0 +1,262 @@
+// Copyright (c) 2012-2013 Bryce Adelstein-Lelbach
+// Copyright (c) 2012-2013 Hartmut Kaiser
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+// Measures the cost of serializing, queueing and executing parcels, without
+// any socket I/O: all localities live in this process and are connected by
+// loopback connections.
+//
+// With --record-parcels, locality 1 records the parcels it receives in a
+// parcel log. With --replay, no localities are connected; instead, a recorded
+// log is fed into a single runtime, which measures just deserializing and
+// executing the parcels (as recorded, or at the recorded pace with
+// --original-speed).
+
+#include <chrono>
+#include <iostream>
+
+#include <boost/program_options.hpp>
+#include <boost/serialization/export.hpp>
+#include <boost/serialization/tracking.hpp>
+#include <boost/serialization/base_object.hpp>
+#include <boost/archive/binary_oarchive.hpp>
+#include <boost/archive/binary_iarchive.hpp>
+
+#include "runtime.hpp"
+#include "action_registry.hpp"
+
+namespace po = boost::program_options;
+
+std::atomic<boost::uint64_t> received(0);
+
+struct count_action : action
+{
+    void operator()(runtime&)
+    {
+        ++received;
+    }
+
+    action* clone() const
+    {
+        return new count_action;
+    }
+
+    template <typename Archive>
+    void serialize(Archive& ar, const unsigned int)
+    {
+        ar & boost::serialization::base_object<action>(*this);
+    }
+};
+
+BOOST_CLASS_EXPORT_GUID(count_action, "count_action");
+BOOST_CLASS_TRACKING(count_action, boost::serialization::track_never);
+REGISTER_ACTION(count_action);
+
+std::chrono::high_resolution_clock::time_point start_time;
+
+void benchmark_main(runtime& rt, boost::uint64_t parcels)
+{
+    count_action t;
+
+    auto conns = rt.get_connections();
+
+    start_time = std::chrono::high_resolution_clock::now();
+
+    for (boost::uint64_t i = 0; i < parcels; ++i)
+        for (auto node : conns)
+            node.second->async_write(t);
+}
+
+int replay(std::string const& path, bool original_speed)
+{
+    parcel_log_reader log(path);
+
+    runtime rt("");
+    rt.start();
+
+    std::thread t(boost::bind(&runtime::run, &rt));
+
+    start_time = std::chrono::high_resolution_clock::now();
+
+    boost::uint64_t parcels = 0;
+
+    try
+    {
+        parcels = rt.replay_parcels(log, original_speed);
+    }
+    catch (std::ios_base::failure const& e)
+    {
+        std::cerr << path << ": " << e.what() << "\n";
+
+        rt.stop();
+        t.join();
+
+        return 1;
+    }
+
+    // Parcels for other actions, or which the runtime drops (like compact
+    // parcels for actions it doesn't know), never count as received, so we
+    // give up once none have been for a while.
+    std::chrono::high_resolution_clock::time_point last_progress = start_time;
+    boost::uint64_t executed = 0;
+
+    while (executed < parcels)
+    {
+        std::chrono::high_resolution_clock::time_point now
+            = std::chrono::high_resolution_clock::now();
+
+        boost::uint64_t r = received.load();
+
+        if (r != executed)
+        {
+            executed = r;
+            last_progress = now;
+        }
+
+        else if (now - last_progress > std::chrono::seconds(1))
+            break;
+
+        std::this_thread::yield();
+    }
+
+    std::chrono::duration<double> elapsed = (executed < parcels)
+        ? last_progress - start_time
+        : std::chrono::high_resolution_clock::now() - start_time;
+
+    rt.stop();
+    t.join();
+
+    if (executed < parcels)
+        std::cerr << path << ": only " << executed << " of " << parcels
+                  << " parcels were executed as count_actions ("
+                  << rt.get_parcels_dropped() << " dropped)\n";
+
+    double seconds = elapsed.count();
+
+    std::cout << "replayed:     " << parcels << "\n"
+              << "executed:     " << executed << "\n"
+              << "seconds:      " << seconds << "\n"
+              << "parcels/s:    " << (executed / seconds) << "\n"
+              << "ns/parcel:    " << (seconds * 1e9 / executed) << "\n";
+
+    return executed == parcels ? 0 : 1;
+}
+
+int main(int argc, char** argv)
+{
+    // Parse command line.
+    po::variables_map vm;
+
+    po::options_description
+        cmdline("Usage: loopback_benchmark [--localities <n>] [--parcels <n>]"
+                " [--compact-parcels] [--record-parcels <path>]\n"
+                "       loopback_benchmark --replay <path>"
+                " [--original-speed]");
+
+    cmdline.add_options()
+        ( "help,h"
+        , "print out program usage (this message)")
+
+        ( "localities"
+        , po::value<boost::uint64_t>()->default_value(2)
+        , "number of localities to run in this process")
+
+        ( "parcels"
+        , po::value<boost::uint64_t>()->default_value(100000)
+        , "number of parcels to send to each remote locality")
+
+        ( "compact-parcels"
+        , "send parcels without per-parcel archive headers")
+
+        ( "record-parcels"
+        , po::value<std::string>()
+        , "record the parcels received by locality 1 in a parcel log")
+
+        ( "replay"
+        , po::value<std::string>()
+        , "execute the parcels in a parcel log instead")
+
+        ( "original-speed"
+        , "replay parcels at the pace they were recorded at")
+    ;
+
+    po::store(po::command_line_parser(argc, argv).options(cmdline).run(), vm);
+
+    po::notify(vm);
+
+    // Print help screen.
+    if (vm.count("help"))
+    {
+        std::cout << cmdline;
+        return 1;
+    }
+
+    if (vm.count("replay"))
+        return replay(vm["replay"].as<std::string>()
+                    , vm.count("original-speed") != 0);
+
+    boost::uint64_t localities = vm["localities"].as<boost::uint64_t>();
+    boost::uint64_t parcels = vm["parcels"].as<boost::uint64_t>();
+
+    if (localities < 2)
+    {
+        std::cerr << "need at least 2 localities\n";
+        return 1;
+    }
+
+    boost::uint64_t expected = parcels * (localities - 1);
+
+    // Locality 0 sends parcels to everyone else once they've all connected.
+    std::vector<std::shared_ptr<runtime> > rts;
+
+    rts.emplace_back(new runtime(""
+      , boost::bind(&benchmark_main, _1, parcels), localities - 1));
+
+    for (boost::uint64_t i = 1; i < localities; ++i)
+        rts.emplace_back(new runtime(""));
+
+    for (auto rt : rts)
+        rt->set_compact_parcels(vm.count("compact-parcels") != 0);
+
+    if (vm.count("record-parcels"))
+        rts[1]->set_parcel_log(vm["record-parcels"].as<std::string>());
+
+    std::vector<std::thread> threads;
+
+    for (auto rt : rts)
+    {
+        rt->start();
+        threads.emplace_back(boost::bind(&runtime::run, rt));
+    }
+
+    for (boost::uint64_t i = 1; i < localities; ++i)
+        rts[i]->connect(*rts[0]);
+
+    while (received.load() < expected)
+        std::this_thread::yield();
+
+    std::chrono::duration<double> elapsed =
+        std::chrono::high_resolution_clock::now() - start_time;
+
+    for (auto rt : rts)
+        rt->stop();
+
+    for (std::thread& t : threads)
+        t.join();
+
+    double seconds = elapsed.count();
+    double bytes = double(rts[0]->get_bytes_sent());
+
+    std::cout << "localities:   " << localities << "\n"
+              << "parcels:      " << expected << "\n"
+              << "seconds:      " << seconds << "\n"
+              << "parcels/s:    " << (expected / seconds) << "\n"
+              << "ns/parcel:    " << (seconds * 1e9 / expected) << "\n"
+              << "bytes/parcel: " << (bytes / rts[0]->get_parcels_sent())
+              << "\n";
+
+    return 0;
+}
+
@@ -0,0 +1,291 @@
+// Copyright (c) 2012-2013 Bryce Adelstein-Lelbach
+// Copyright (c) 2012-2013 Hartmut Kaiser
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+#if !defined(CPPNOW_98B5AC5D_70F7_4D8E_8F9A_6DAC5478AD50)
+#define CPPNOW_98B5AC5D_70F7_4D8E_8F9A_6DAC5478AD50
+
+#include <array>
+#include <cstring>
+#include <vector>
+
+#include <boost/cstdint.hpp>
+#include <boost/serialization/extended_type_info_typeid.hpp>
+
+#include "action.hpp"
+
+namespace detail
+{
+
+inline void encode_le(char* p, boost::uint64_t v, std::size_t bytes)
+{
+    for (std::size_t i = 0; i < bytes; ++i)
+        p[i] = static_cast<char>((v >> (8 * i)) & 0xFF);
+}
+
+inline boost::uint64_t decode_le(char const* p, std::size_t bytes)
+{
+    boost::uint64_t v = 0;
+    for (std::size_t i = 0; i < bytes; ++i)
+        v |= boost::uint64_t(static_cast<unsigned char>(p[i])) << (8 * i);
+    return v;
+}
+
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// The fixed size header which precedes every parcel on the wire. It carries
+/// everything needed to route a parcel, so that intermediate localities can
+/// forward it to its destination without deserializing the payload.
+///
+/// Wire layout (all fields little-endian):
+///
+///     offset  size  field
+///     0       8     destination locality
+///     8       8     payload size
+///     16      4     action id
+///     20      1     flags
+///     21      1     hops left
+///     22      1     priority
+///     23      1     version
+struct parcel_header
+{
+    static const std::size_t size = 24;
+    static const boost::uint8_t current_version = 2;
+
+    /// How many times a new parcel may be forwarded before it is dropped,
+    /// so that a cycle of routes can't pass it around forever.
+    static const boost::uint8_t default_hop_limit = 32;
+
+    /// The largest payload a locality accepts. Connections that announce a
+    /// larger one are closed, rather than trusting the size to allocate.
+    static const boost::uint64_t max_payload_size = boost::uint64_t(1) << 30;
+
+    typedef std::array<char, size> buffer_type;
+
+    enum flag_type
+    {
+        no_flags  = 0,
+        forwarded = 1 << 0, ///< Passed through at least one intermediate node.
+        compact   = 1 << 1, ///< Payload is a bare action body; the archive
+                            ///< header and class metadata were negotiated
+                            ///< when the connection was established.
+        migratable    = 1 << 2, ///< The action may be executed by any
+                                ///< locality (see is_migratable()).
+        migrated      = 1 << 3, ///< Moved by the load balancer. Executed
+                                ///< where it arrives, never moved again.
+        load_report   = 1 << 4, ///< Control parcel carrying the queue depth
+                                ///< of the sender; no action.
+        steal_request = 1 << 5, ///< Control parcel from an idle sender,
+                                ///< asking for migratable parcels; no action.
+        control = load_report | steal_request
+    };
+
+    enum priority_type
+    {
+        low_priority    = 0,
+        normal_priority = 1,
+        high_priority   = 2
+    };
+
+    boost::uint64_t destination;
+    boost::uint64_t payload_size;
+    boost::uint32_t action_id;
+    boost::uint8_t flags;
+    boost::uint8_t hops_left;
+    boost::uint8_t priority;
+    boost::uint8_t version;
+
+    parcel_header()
+      : destination(0)
+      , payload_size(0)
+      , action_id(0)
+      , flags(no_flags)
+      , hops_left(default_hop_limit)
+      , priority(normal_priority)
+      , version(current_version)
+    {}
+
+    void encode(buffer_type& buf) const
+    {
+        detail::encode_le(&buf[0], destination, 8);
+        detail::encode_le(&buf[8], payload_size, 8);
+        detail::encode_le(&buf[16], action_id, 4);
+        detail::encode_le(&buf[20], flags, 1);
+        detail::encode_le(&buf[21], hops_left, 1);
+        detail::encode_le(&buf[22], priority, 1);
+        detail::encode_le(&buf[23], version, 1);
+    }
+
+    void decode(buffer_type const& buf)
+    {
+        using detail::decode_le;
+        destination  = decode_le(&buf[0], 8);
+        payload_size = decode_le(&buf[8], 8);
+        action_id    = static_cast<boost::uint32_t>(decode_le(&buf[16], 4));
+        flags        = static_cast<boost::uint8_t>(decode_le(&buf[20], 1));
+        hops_left    = static_cast<boost::uint8_t>(decode_le(&buf[21], 1));
+        priority     = static_cast<boost::uint8_t>(decode_le(&buf[22], 1));
+        version      = static_cast<boost::uint8_t>(decode_le(&buf[23], 1));
+    }
+};
+
+///////////////////////////////////////////////////////////////////////////////
+/// A parcel that has been received, but not yet deserialized.
+struct parcel
+{
+    parcel_header header;
+    std::vector<char> payload;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+/// The first thing each side writes to a new connection.
+///
+/// Wire layout (all fields little-endian):
+///
+///     offset  size  field
+///     0       8     locality id
+///     8       4     Boost.Serialization archive version
+///     12      4     capabilities
+///     16      4     native format (see native_format())
+struct handshake
+{
+    static const std::size_t size = 20;
+
+    typedef std::array<char, size> buffer_type;
+
+    enum capability_type
+    {
+        no_capabilities = 0,
+        compact_parcels = 1 << 0 ///< Can send and receive compact parcels.
+    };
+
+    boost::uint64_t locality;
+    boost::uint32_t archive_version;
+    boost::uint32_t capabilities;
+    boost::uint32_t native_format;
+
+    handshake()
+      : locality(0)
+      , archive_version(0)
+      , capabilities(no_capabilities)
+      , native_format(0)
+    {}
+
+    /// Describes how this machine lays out plain data: the first byte of the
+    /// native representation of 1 in a 4 byte integer (1 on little-endian
+    /// machines, 0 on big-endian ones), and the sizes of int, long and
+    /// double. Binary archives write the same checks into their header;
+    /// compact parcels have no header, and bitwise serialized types are
+    /// copied as raw memory, so both ends must agree on this instead.
+    static boost::uint32_t local_native_format()
+    {
+        boost::uint32_t one = 1;
+        unsigned char first = 0;
+        std::memcpy(&first, &one, 1);
+
+        return boost::uint32_t(first)
+             | (boost::uint32_t(sizeof(int)) << 8)
+             | (boost::uint32_t(sizeof(long)) << 16)
+             | (boost::uint32_t(sizeof(double)) << 24);
+    }
+
+    void encode(buffer_type& buf) const
+    {
+        detail::encode_le(&buf[0], locality, 8);
+        detail::encode_le(&buf[8], archive_version, 4);
+        detail::encode_le(&buf[12], capabilities, 4);
+        detail::encode_le(&buf[16], native_format, 4);
+    }
+
+    void decode(buffer_type const& buf)
+    {
+        using detail::decode_le;
+        locality        = decode_le(&buf[0], 8);
+        archive_version = static_cast<boost::uint32_t>(decode_le(&buf[8], 4));
+        capabilities    = static_cast<boost::uint32_t>(decode_le(&buf[12], 4));
+        native_format   = static_cast<boost::uint32_t>(decode_le(&buf[16], 4));
+    }
+};
+
+///////////////////////////////////////////////////////////////////////////////
+/// The payload of the control parcels which load balancing localities
+/// exchange with their neighbours. For a load report, value is the number of
+/// parcels queued at the sender; for a steal request, the number of parcels
+/// it asks for.
+///
+/// Wire layout (all fields little-endian):
+///
+///     offset  size  field
+///     0       8     locality id of the sender
+///     8       8     value
+struct control_message
+{
+    static const std::size_t size = 16;
+
+    typedef std::array<char, size> buffer_type;
+
+    boost::uint64_t locality;
+    boost::uint64_t value;
+
+    control_message()
+      : locality(0)
+      , value(0)
+    {}
+
+    control_message(boost::uint64_t locality_, boost::uint64_t value_)
+      : locality(locality_)
+      , value(value_)
+    {}
+
+    void encode(buffer_type& buf) const
+    {
+        detail::encode_le(&buf[0], locality, 8);
+        detail::encode_le(&buf[8], value, 8);
+    }
+
+    void decode(buffer_type const& buf)
+    {
+        using detail::decode_le;
+        locality = decode_le(&buf[0], 8);
+        value    = decode_le(&buf[8], 8);
+    }
+};
+
+///////////////////////////////////////////////////////////////////////////////
+/// Returns the action id for an export GUID.
+inline boost::uint32_t get_action_id(char const* key)
+{
+    if (!key)
+        return 0;
+
+    // 32-bit FNV-1a.
+    boost::uint32_t h = 2166136261u;
+    for (; *key; ++key)
+    {
+        h ^= static_cast<unsigned char>(*key);
+        h *= 16777619u;
+    }
+    return h;
+}
+
+/// Returns a stable id for the dynamic type of act, computed from the GUID it
+/// was exported with (BOOST_CLASS_EXPORT_GUID). Returns 0 for actions which
+/// were not exported.
+template <typename Runtime>
+inline boost::uint32_t get_action_id(basic_action<Runtime> const& act)
+{
+    typedef boost::serialization::extended_type_info_typeid<
+        basic_action<Runtime>
+    > eti_type;
+
+    boost::serialization::extended_type_info const* eti =
+        eti_type::get_const_instance().get_derived_extended_type_info(act);
+
+    return get_action_id(eti ? eti->get_key() : 0);
+}
+
+#endif
+
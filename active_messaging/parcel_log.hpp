@@ -0,0 +1,219 @@
+// Copyright (c) 2012-2013 Bryce Adelstein-Lelbach
+// Copyright (c) 2012-2013 Hartmut Kaiser
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+#if !defined(CPPNOW_C058A675_2FF5_4D8F_9E18_1668C722513C)
+#define CPPNOW_C058A675_2FF5_4D8F_9E18_1668C722513C
+
+#include <chrono>
+#include <cstring>
+#include <ios>
+#include <mutex>
+#include <string>
+
+#include <boost/cstdint.hpp>
+#include <boost/iostreams/device/mapped_file.hpp>
+
+#include "parcel.hpp"
+
+///////////////////////////////////////////////////////////////////////////////
+/// An append-only log of the parcels a locality received, kept in a
+/// memory-mapped file so that recording is a memcpy rather than a system
+/// call per parcel. Written by parcel_log_writer, read by parcel_log_reader.
+///
+/// File layout (all fields little-endian):
+///
+///     offset  size  field
+///     0       8     magic ("PCLLOG01")
+///     8       8     locality id of the recording node
+///     16      8     end of the last complete record
+///     24      8     reserved
+///     32            records
+///
+/// Each record is:
+///
+///     offset  size  field
+///     0       8     nanoseconds since recording started
+///     8       8     locality id of the neighbour it came from
+///     16      24    parcel header (see parcel_header)
+///     40            payload
+///
+/// The file is grown in large steps and trimmed when the writer is closed.
+/// The end offset is only advanced once a record is complete, so if the
+/// process dies, the log is still valid up to the last parcel it recorded.
+struct parcel_log
+{
+    static const std::size_t header_size = 32;
+    static const std::size_t record_header_size = 16 + parcel_header::size;
+
+    static char const* magic()
+    {
+        return "PCLLOG01";
+    }
+};
+
+///////////////////////////////////////////////////////////////////////////////
+struct parcel_log_writer
+{
+  private:
+    typedef std::chrono::steady_clock clock_type;
+
+    static const std::size_t growth = 64 * 1024 * 1024;
+
+    std::mutex mtx_;
+    boost::iostreams::mapped_file file_;
+    std::size_t end_;
+    clock_type::time_point start_;
+
+  public:
+    /// Creates (or truncates) the log at path.
+    parcel_log_writer(std::string const& path, boost::uint64_t locality)
+      : mtx_()
+      , file_()
+      , end_(parcel_log::header_size)
+      , start_(clock_type::now())
+    {
+        boost::iostreams::mapped_file_params params(path);
+        params.flags = boost::iostreams::mapped_file::readwrite;
+        params.new_file_size = growth;
+
+        file_.open(params);
+
+        char* p = file_.data();
+        std::memcpy(p, parcel_log::magic(), 8);
+        detail::encode_le(p + 8, locality, 8);
+        detail::encode_le(p + 16, end_, 8);
+        detail::encode_le(p + 24, 0, 8);
+    }
+
+    ~parcel_log_writer()
+    {
+        // Give back the space we grew into but didn't use.
+        file_.resize(end_);
+        file_.close();
+    }
+
+    /// Appends a parcel received from source. Can be called from any thread.
+    void append(
+        boost::uint64_t source
+      , parcel_header const& header
+      , char const* payload
+        )
+    {
+        boost::uint64_t ns = std::chrono::duration_cast<
+            std::chrono::nanoseconds>(clock_type::now() - start_).count();
+
+        std::size_t size = parcel_log::record_header_size
+                         + std::size_t(header.payload_size);
+
+        std::lock_guard<std::mutex> l(mtx_);
+
+        if (end_ + size > std::size_t(file_.size()))
+            file_.resize(((end_ + size) / growth + 1) * growth);
+
+        char* p = file_.data() + end_;
+
+        detail::encode_le(p, ns, 8);
+        detail::encode_le(p + 8, source, 8);
+
+        parcel_header::buffer_type buf;
+        header.encode(buf);
+        std::memcpy(p + 16, buf.data(), buf.size());
+
+        std::memcpy(p + parcel_log::record_header_size, payload
+                  , std::size_t(header.payload_size));
+
+        end_ += size;
+        detail::encode_le(file_.data() + 16, end_, 8);
+    }
+};
+
+///////////////////////////////////////////////////////////////////////////////
+struct parcel_log_reader
+{
+    struct record
+    {
+        /// When the parcel was received, relative to when recording started.
+        std::chrono::nanoseconds timestamp;
+        boost::uint64_t source;
+        parcel_header header;
+        char const* payload;
+    };
+
+  private:
+    boost::iostreams::mapped_file_source file_;
+    boost::uint64_t locality_;
+    std::size_t end_;
+    std::size_t next_;
+
+  public:
+    /// Opens the log at path. Throws std::ios_base::failure if it isn't one.
+    explicit parcel_log_reader(std::string const& path)
+      : file_(path)
+      , locality_(0)
+      , end_(0)
+      , next_(parcel_log::header_size)
+    {
+        char const* p = file_.data();
+
+        if (  file_.size() < parcel_log::header_size
+           || std::memcmp(p, parcel_log::magic(), 8) != 0)
+            throw std::ios_base::failure(path + " is not a parcel log");
+
+        locality_ = detail::decode_le(p + 8, 8);
+        end_ = std::size_t(detail::decode_le(p + 16, 8));
+
+        if (end_ < parcel_log::header_size || end_ > file_.size())
+            throw std::ios_base::failure(path + " is truncated");
+    }
+
+    /// The locality which recorded the log.
+    boost::uint64_t get_locality() const
+    {
+        return locality_;
+    }
+
+    /// Reads the next record. The payload points into the mapping, and stays
+    /// valid for as long as the reader. Returns false at the end of the log.
+    /// Throws std::ios_base::failure if a record runs past the end of it.
+    bool next(record& r)
+    {
+        if (end_ - next_ < parcel_log::record_header_size)
+            return false;
+
+        char const* p = file_.data() + next_;
+
+        r.timestamp = std::chrono::nanoseconds(detail::decode_le(p, 8));
+        r.source = detail::decode_le(p + 8, 8);
+
+        parcel_header::buffer_type buf;
+        std::memcpy(buf.data(), p + 16, buf.size());
+        r.header.decode(buf);
+
+        // The writer only commits complete records, so this log has been
+        // damaged, or wasn't written by us.
+        if (  r.header.payload_size
+            > end_ - next_ - parcel_log::record_header_size)
+            throw std::ios_base::failure("parcel log record at offset "
+                + std::to_string(next_) + " runs past the end of the log");
+
+        std::size_t size = parcel_log::record_header_size
+                         + std::size_t(r.header.payload_size);
+
+        r.payload = p + parcel_log::record_header_size;
+        next_ += size;
+
+        return true;
+    }
+
+    /// Start reading from the first record again.
+    void rewind()
+    {
+        next_ = parcel_log::header_size;
+    }
+};
+
+#endif
+
@@ -0,0 +1,286 @@
+// Copyright (c) 2012-2013 Bryce Adelstein-Lelbach
+// Copyright (c) 2012-2013 Hartmut Kaiser
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+#if !defined(CPPNOW_2F6654D6_C0E7_41A8_850D_2AE968AD038A)
+#define CPPNOW_2F6654D6_C0E7_41A8_850D_2AE968AD038A
+
+#include <numeric>
+#include <vector>
+
+#include <boost/cstdint.hpp>
+#include <boost/preprocessor/cat.hpp>
+#include <boost/preprocessor/stringize.hpp>
+#include <boost/serialization/vector.hpp>
+
+#include "gather.hpp"
+
+///////////////////////////////////////////////////////////////////////////////
+/// The part of a partitioned_vector which lives on one locality. Registered
+/// with that locality's runtime under the id of the vector.
+template <typename T>
+struct segment
+{
+    std::vector<T> data;
+
+    // Buckets received from each segment while sorting, and how many of
+    // them have arrived.
+    std::vector<std::vector<T> > incoming;
+    std::size_t received;
+
+    explicit segment(std::size_t size)
+      : data(size)
+      , incoming()
+      , received(0)
+    {}
+};
+
+/// A vector whose elements are spread across localities, in one contiguous
+/// segment per locality. This is just a handle: it can be copied freely, and
+/// the segments stay alive until destroy() is called.
+template <typename T>
+struct partitioned_vector
+{
+  private:
+    boost::uint64_t id_;
+
+    // Segment i lives on locality localities_[i], and holds sizes_[i]
+    // elements.
+    std::vector<boost::uint64_t> localities_;
+    std::vector<boost::uint64_t> sizes_;
+
+  public:
+    partitioned_vector()
+      : id_(0)
+      , localities_()
+      , sizes_()
+    {}
+
+    partitioned_vector(
+        boost::uint64_t id
+      , std::vector<boost::uint64_t> const& localities
+      , std::vector<boost::uint64_t> const& sizes
+        )
+      : id_(id)
+      , localities_(localities)
+      , sizes_(sizes)
+    {
+        BOOST_ASSERT(localities_.size() == sizes_.size());
+    }
+
+    boost::uint64_t get_id() const
+    {
+        return id_;
+    }
+
+    std::vector<boost::uint64_t> const& get_localities() const
+    {
+        return localities_;
+    }
+
+    std::vector<boost::uint64_t> const& get_sizes() const
+    {
+        return sizes_;
+    }
+
+    /// Algorithms which move elements between segments update the sizes.
+    void set_sizes(std::vector<boost::uint64_t> const& sizes)
+    {
+        BOOST_ASSERT(sizes.size() == localities_.size());
+        sizes_ = sizes;
+    }
+
+    boost::uint64_t size() const
+    {
+        return std::accumulate(sizes_.begin(), sizes_.end()
+                             , boost::uint64_t(0));
+    }
+};
+
+///////////////////////////////////////////////////////////////////////////////
+template <typename Runtime, typename T>
+struct create_segment_action : basic_action<Runtime>
+{
+  private:
+    boost::uint64_t id_;
+    boost::uint64_t size_;
+    reply_address reply_;
+
+  public:
+    create_segment_action()
+      : id_(0)
+      , size_(0)
+      , reply_()
+    {}
+
+    create_segment_action(
+        boost::uint64_t id
+      , boost::uint64_t size
+      , reply_address const& reply_to
+        )
+      : id_(id)
+      , size_(size)
+      , reply_(reply_to)
+    {}
+
+    void operator()(Runtime& rt)
+    {
+        rt.register_object(id_, std::make_shared<segment<T> >(size_));
+
+        reply<segment<T> >(rt, reply_, size_);
+    }
+
+    basic_action<Runtime>* clone() const
+    {
+        return new create_segment_action(*this);
+    }
+
+    template <typename Archive>
+    void serialize(Archive& ar, const unsigned int)
+    {
+        ar & boost::serialization::base_object<basic_action<Runtime> >(*this);
+        ar & id_;
+        ar & size_;
+        ar & reply_;
+    }
+};
+
+template <typename Runtime, typename T>
+struct destroy_segment_action : basic_action<Runtime>
+{
+  private:
+    boost::uint64_t id_;
+
+  public:
+    destroy_segment_action()
+      : id_(0)
+    {}
+
+    explicit destroy_segment_action(boost::uint64_t id)
+      : id_(id)
+    {}
+
+    void operator()(Runtime& rt)
+    {
+        rt.unregister_object(id_);
+    }
+
+    basic_action<Runtime>* clone() const
+    {
+        return new destroy_segment_action(*this);
+    }
+
+    template <typename Archive>
+    void serialize(Archive& ar, const unsigned int)
+    {
+        ar & boost::serialization::base_object<basic_action<Runtime> >(*this);
+        ar & id_;
+    }
+};
+
+///////////////////////////////////////////////////////////////////////////////
+/// Returns this locality followed by its direct neighbours.
+template <typename Runtime>
+std::vector<boost::uint64_t> all_localities(Runtime& rt)
+{
+    std::vector<boost::uint64_t> localities(1, rt.get_locality_id());
+
+    typename Runtime::connection_map conns = rt.get_connections();
+
+    for (typename Runtime::connection_map::const_iterator it = conns.begin();
+         it != conns.end(); ++it)
+        localities.push_back(it->first);
+
+    return localities;
+}
+
+/// Returns the indices of the segments of v, with the ones on other
+/// localities first. Algorithms send their requests in this order, so that
+/// the other localities can start working while this one does its share.
+template <typename Runtime, typename T>
+std::vector<std::size_t> dispatch_order(
+    Runtime& rt
+  , partitioned_vector<T> const& v
+    )
+{
+    std::vector<std::size_t> order;
+    std::vector<std::size_t> local;
+
+    for (std::size_t i = 0; i < v.get_localities().size(); ++i)
+    {
+        if (v.get_localities()[i] == rt.get_locality_id())
+            local.push_back(i);
+        else
+            order.push_back(i);
+    }
+
+    order.insert(order.end(), local.begin(), local.end());
+    return order;
+}
+
+/// Creates a partitioned_vector of size default-constructed elements,
+/// divided evenly between localities. Returns once all the segments exist.
+/// Like the algorithms, this can be called from a task (which is suspended
+/// while waiting) or from any other thread (which blocks).
+template <typename T, typename Runtime>
+partitioned_vector<T> make_partitioned_vector(
+    Runtime& rt
+  , std::vector<boost::uint64_t> const& localities
+  , boost::uint64_t size
+    )
+{
+    BOOST_ASSERT(!localities.empty());
+
+    std::size_t n = localities.size();
+
+    std::vector<boost::uint64_t> sizes(n);
+
+    for (std::size_t i = 0; i < n; ++i)
+        sizes[i] = size * (i + 1) / n - size * i / n;
+
+    partitioned_vector<T> v(rt.new_object_id(), localities, sizes);
+
+    gather<Runtime, boost::uint64_t> created(rt, n);
+
+    std::vector<std::size_t> order = dispatch_order(rt, v);
+
+    for (std::size_t i : order)
+        rt.async_write(localities[i],
+            create_segment_action<Runtime, T>(v.get_id(), sizes[i]
+                                            , created.address(i)));
+
+    created.get();
+
+    return v;
+}
+
+/// Frees the segments of v. Doesn't wait.
+template <typename Runtime, typename T>
+void destroy(Runtime& rt, partitioned_vector<T> const& v)
+{
+    for (boost::uint64_t locality : v.get_localities())
+        rt.async_write(locality
+                     , destroy_segment_action<Runtime, T>(v.get_id()));
+}
+
+/// Registers the actions which create and destroy partitioned_vectors of T,
+/// for the default runtime.
+#define REGISTER_PARTITIONED_VECTOR(T)                                        \
+    typedef create_segment_action<runtime, T>                                 \
+        BOOST_PP_CAT(create_segment_action_, __LINE__);                       \
+    REGISTER_ALGORITHM_ACTION(BOOST_PP_CAT(create_segment_action_, __LINE__)  \
+      , "create_segment_action<" BOOST_PP_STRINGIZE(T) ">");                  \
+    typedef gather_action<runtime, boost::uint64_t, segment<T> >              \
+        BOOST_PP_CAT(create_segment_reply_, __LINE__);                        \
+    REGISTER_ALGORITHM_ACTION(BOOST_PP_CAT(create_segment_reply_, __LINE__)   \
+      , "create_segment_reply<" BOOST_PP_STRINGIZE(T) ">");                   \
+    typedef destroy_segment_action<runtime, T>                                \
+        BOOST_PP_CAT(destroy_segment_action_, __LINE__);                      \
+    REGISTER_ALGORITHM_ACTION(BOOST_PP_CAT(destroy_segment_action_, __LINE__) \
+      , "destroy_segment_action<" BOOST_PP_STRINGIZE(T) ">")                  \
+    /**/
+
+#endif
+
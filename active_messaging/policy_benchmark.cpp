@@ -0,0 +1,241 @@
+// Copyright (c) 2012-2013 Bryce Adelstein-Lelbach
+// Copyright (c) 2012-2013 Hartmut Kaiser
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+// Runs the loopback benchmark (one locality sending parcels to another in
+// the same process) with basic_runtime instantiated with different
+// transport, serializer and queue policies, changing one policy at a time
+// and then all of them, and compares each to the default runtime.
+
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+
+#include <boost/program_options.hpp>
+#include <boost/serialization/export.hpp>
+#include <boost/serialization/tracking.hpp>
+#include <boost/serialization/base_object.hpp>
+#include <boost/archive/binary_oarchive.hpp>
+#include <boost/archive/binary_iarchive.hpp>
+
+#include "runtime_impl.hpp"
+#include "action_registry.hpp"
+
+namespace po = boost::program_options;
+
+typedef basic_runtime<any_transport, streambuf_serializer, lockfree_queue>
+    streambuf_runtime;
+
+typedef basic_runtime<any_transport, iostream_serializer, locked_queue>
+    locked_runtime;
+
+typedef basic_runtime<loopback_transport, iostream_serializer, lockfree_queue>
+    loopback_runtime;
+
+typedef basic_runtime<loopback_transport, streambuf_serializer, locked_queue>
+    specialized_runtime;
+
+std::atomic<boost::uint64_t> received(0);
+
+template <typename Runtime>
+struct count_action : basic_action<Runtime>
+{
+    void operator()(Runtime&)
+    {
+        ++received;
+    }
+
+    basic_action<Runtime>* clone() const
+    {
+        return new count_action;
+    }
+
+    template <typename Archive>
+    void serialize(Archive& ar, const unsigned int)
+    {
+        ar & boost::serialization::base_object<basic_action<Runtime> >(*this);
+    }
+};
+
+BOOST_CLASS_EXPORT_GUID(count_action<runtime>, "count_action");
+BOOST_CLASS_TRACKING(count_action<runtime>
+                   , boost::serialization::track_never);
+REGISTER_ACTION(count_action<runtime>);
+
+BOOST_CLASS_EXPORT_GUID(count_action<streambuf_runtime>
+                      , "count_action_streambuf");
+BOOST_CLASS_TRACKING(count_action<streambuf_runtime>
+                   , boost::serialization::track_never);
+REGISTER_ACTION(count_action<streambuf_runtime>);
+
+BOOST_CLASS_EXPORT_GUID(count_action<locked_runtime>
+                      , "count_action_locked");
+BOOST_CLASS_TRACKING(count_action<locked_runtime>
+                   , boost::serialization::track_never);
+REGISTER_ACTION(count_action<locked_runtime>);
+
+BOOST_CLASS_EXPORT_GUID(count_action<loopback_runtime>
+                      , "count_action_loopback");
+BOOST_CLASS_TRACKING(count_action<loopback_runtime>
+                   , boost::serialization::track_never);
+REGISTER_ACTION(count_action<loopback_runtime>);
+
+BOOST_CLASS_EXPORT_GUID(count_action<specialized_runtime>
+                      , "count_action_specialized");
+BOOST_CLASS_TRACKING(count_action<specialized_runtime>
+                   , boost::serialization::track_never);
+REGISTER_ACTION(count_action<specialized_runtime>);
+
+std::chrono::high_resolution_clock::time_point start_time;
+
+template <typename Runtime>
+void benchmark_main(Runtime& rt, boost::uint64_t parcels)
+{
+    count_action<Runtime> t;
+
+    auto conns = rt.get_connections();
+
+    start_time = std::chrono::high_resolution_clock::now();
+
+    for (boost::uint64_t i = 0; i < parcels; ++i)
+        for (auto node : conns)
+            node.second->async_write(t);
+}
+
+/// Returns the seconds it took locality 0 to send parcels to locality 1, and
+/// for locality 1 to execute them.
+template <typename Runtime>
+double run_once(boost::uint64_t parcels, bool compact)
+{
+    received.store(0);
+
+    Runtime sender(""
+      , boost::bind(&benchmark_main<Runtime>, _1, parcels));
+    Runtime receiver("");
+
+    sender.set_compact_parcels(compact);
+    receiver.set_compact_parcels(compact);
+
+    sender.start();
+    receiver.start();
+
+    std::thread sender_thread(boost::bind(&Runtime::run, &sender));
+    std::thread receiver_thread(boost::bind(&Runtime::run, &receiver));
+
+    receiver.connect(sender);
+
+    while (received.load() < parcels)
+        std::this_thread::yield();
+
+    std::chrono::duration<double> elapsed =
+        std::chrono::high_resolution_clock::now() - start_time;
+
+    sender.stop();
+    receiver.stop();
+
+    sender_thread.join();
+    receiver_thread.join();
+
+    return elapsed.count();
+}
+
+/// Prints the best of runs runs, and returns its parcels/s.
+template <typename Runtime>
+double benchmark(
+    char const* name
+  , boost::uint64_t parcels
+  , bool compact
+  , boost::uint64_t runs
+  , double baseline
+    )
+{
+    double best = 0;
+
+    for (boost::uint64_t i = 0; i < runs; ++i)
+    {
+        double seconds = run_once<Runtime>(parcels, compact);
+
+        if (i == 0 || seconds < best)
+            best = seconds;
+    }
+
+    double rate = parcels / best;
+
+    std::cout << std::left << std::setw(44) << name << std::right
+              << std::setw(12) << std::fixed << std::setprecision(0) << rate
+              << std::setw(12) << std::setprecision(1)
+              << (best * 1e9 / parcels)
+              << std::setw(10) << std::setprecision(2)
+              << (baseline != 0 ? rate / baseline : 1.0) << "x\n";
+
+    return rate;
+}
+
+int main(int argc, char** argv)
+{
+    // Parse command line.
+    po::variables_map vm;
+
+    po::options_description
+        cmdline("Usage: policy_benchmark [--parcels <n>] [--runs <n>]"
+                " [--compact-parcels]");
+
+    cmdline.add_options()
+        ( "help,h"
+        , "print out program usage (this message)")
+
+        ( "parcels"
+        , po::value<boost::uint64_t>()->default_value(100000)
+        , "number of parcels to send in each run")
+
+        ( "runs"
+        , po::value<boost::uint64_t>()->default_value(3)
+        , "number of runs per configuration (the best one is reported)")
+
+        ( "compact-parcels"
+        , "send parcels without per-parcel archive headers")
+    ;
+
+    po::store(po::command_line_parser(argc, argv).options(cmdline).run(), vm);
+
+    po::notify(vm);
+
+    // Print help screen.
+    if (vm.count("help"))
+    {
+        std::cout << cmdline;
+        return 1;
+    }
+
+    boost::uint64_t parcels = std::max<boost::uint64_t>(1
+                                , vm["parcels"].as<boost::uint64_t>());
+    boost::uint64_t runs = std::max<boost::uint64_t>(1
+                             , vm["runs"].as<boost::uint64_t>());
+    bool compact = vm.count("compact-parcels") != 0;
+
+    std::cout << std::left << std::setw(44) << "transport/serializer/queue"
+              << std::right
+              << std::setw(12) << "parcels/s"
+              << std::setw(12) << "ns/parcel"
+              << std::setw(11) << "speedup" << "\n";
+
+    double baseline = benchmark<runtime>(
+        "any/iostream/lockfree (runtime)", parcels, compact, runs, 0);
+
+    benchmark<streambuf_runtime>(
+        "any/streambuf/lockfree", parcels, compact, runs, baseline);
+
+    benchmark<locked_runtime>(
+        "any/iostream/locked", parcels, compact, runs, baseline);
+
+    benchmark<loopback_runtime>(
+        "loopback/iostream/lockfree", parcels, compact, runs, baseline);
+
+    benchmark<specialized_runtime>(
+        "loopback/streambuf/locked", parcels, compact, runs, baseline);
+
+    return 0;
+}
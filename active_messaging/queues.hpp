@@ -0,0 +1,91 @@
+// Copyright (c) 2012-2013 Bryce Adelstein-Lelbach
+// Copyright (c) 2012-2013 Hartmut Kaiser
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+#if !defined(CPPNOW_48EFE5B8_D9B0_4777_AD04_05148383F22C)
+#define CPPNOW_48EFE5B8_D9B0_4777_AD04_05148383F22C
+
+// Queue policies for basic_runtime. A queue policy is a class template
+// Queue<T>, constructible from a number of elements to pre-allocate space
+// for, with
+//
+//     bool push(T const& t);  // Can be called from any thread.
+//     bool pop(T& t);         // Can be called from any thread. Returns
+//                             // false if the queue is empty.
+//
+// The runtime pushes from its I/O and execution threads (and from whichever
+// thread resumes a task). It pops from its execution thread, and, when load
+// balancing, from its I/O threads as well, which hand queued migratable
+// parcels to neighbours that ask for work. Pop must therefore be safe with
+// several consumers; a single-consumer queue is not a valid policy.
+
+#include <atomic>
+#include <deque>
+#include <mutex>
+
+#include <boost/lockfree/queue.hpp>
+
+/// A Boost.Lockfree queue. Never blocks, but every push and pop is a CAS
+/// loop on shared nodes.
+template <typename T>
+struct lockfree_queue : boost::lockfree::queue<T>
+{
+    explicit lockfree_queue(std::size_t reserve)
+      : boost::lockfree::queue<T>(reserve)
+    {}
+};
+
+/// A deque behind a mutex. Popping from an empty queue only reads an atomic
+/// counter, so the execution thread can poll idle queues without taking
+/// their locks.
+template <typename T>
+struct locked_queue
+{
+  private:
+    std::mutex mtx_;
+    std::deque<T> queue_;
+    std::atomic<std::size_t> size_;
+
+  public:
+    /// A deque can't reserve nodes; the argument is only accepted so that
+    /// the queue policies are interchangeable.
+    explicit locked_queue(std::size_t /*reserve*/)
+      : mtx_()
+      , queue_()
+      , size_(0)
+    {}
+
+    bool push(T const& t)
+    {
+        std::lock_guard<std::mutex> l(mtx_);
+        queue_.push_back(t);
+        size_.store(queue_.size(), std::memory_order_release);
+        return true;
+    }
+
+    bool pop(T& t)
+    {
+        if (size_.load(std::memory_order_acquire) == 0)
+            return false;
+
+        std::lock_guard<std::mutex> l(mtx_);
+
+        if (queue_.empty())
+            return false;
+
+        t = queue_.front();
+        queue_.pop_front();
+        size_.store(queue_.size(), std::memory_order_release);
+        return true;
+    }
+
+    bool empty() const
+    {
+        return size_.load(std::memory_order_acquire) == 0;
+    }
+};
+
+#endif
+
@@ -8,8 +8,23 @@
 #if !defined(CPPNOW_3C5121B2_7086_440B_8E4C_D739BA66C4FA)
 #define CPPNOW_3C5121B2_7086_440B_8E4C_D739BA66C4FA
 
+// The runtime is a template, basic_runtime<Transport, Serializer, Queue>, so
+// that a program which only ever uses one transport, one serializer and one
+// kind of queue gets a send and receive path specialized for them, with no
+// virtual calls in between. runtime is the default configuration, and is
+// instantiated once, in runtime.cpp. Programs which use other policies must
+// include runtime_impl.hpp instead of this file.
+
 #include <atomic>
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <thread>
+#include <type_traits>
+#include <vector>
 
 #include <boost/assert.hpp>
 #include <boost/cstdint.hpp>
@@ -17,58 +32,301 @@
 #include <boost/ref.hpp>
 #include <boost/lexical_cast.hpp>
 #include <boost/enable_shared_from_this.hpp>
-#include <boost/lockfree/queue.hpp> 
+#include <boost/asio/steady_timer.hpp>
 
+#include "runtime_fwd.hpp"
 #include "asio_aliases.hpp"
 #include "action.hpp"
+#include "parcel.hpp"
+#include "parcel_log.hpp"
+#include "queues.hpp"
+#include "task.hpp"
+
+template <typename Runtime>
+struct basic_connection;
+
+template <typename Runtime>
+struct basic_tcp_connection;
+
+template <typename Runtime>
+struct basic_loopback_connection;
+
+///////////////////////////////////////////////////////////////////////////////
+// Transport policies. A transport policy picks the type of connection a
+// runtime keeps to its neighbours. Only the connections of that type can be
+// established, but writes to them are direct calls.
+
+/// TCP and loopback connections, through the virtual connection interface.
+struct any_transport
+{
+    template <typename Runtime>
+    struct connection
+    {
+        typedef basic_connection<Runtime> type;
+    };
+};
+
+/// Only TCP connections.
+struct tcp_transport
+{
+    template <typename Runtime>
+    struct connection
+    {
+        typedef basic_tcp_connection<Runtime> type;
+    };
+};
+
+/// Only loopback connections, to other runtimes in the same process. Such
+/// runtimes never listen on a port.
+struct loopback_transport
+{
+    template <typename Runtime>
+    struct connection
+    {
+        typedef basic_loopback_connection<Runtime> type;
+    };
+};
 
-struct connection; 
+///////////////////////////////////////////////////////////////////////////////
+/// Tuning for the load balancer (see basic_runtime::set_load_balancing).
+struct load_balancing_options
+{
+    /// How often a locality tells its neighbours how many parcels it has
+    /// queued, if that changed.
+    std::chrono::microseconds report_interval;
+
+    /// A locality redirects migratable parcels that arrive for it to its
+    /// least loaded neighbour while it has at least this many more parcels
+    /// queued than twice that neighbour's.
+    boost::uint64_t redirect_threshold;
+
+    /// An idle locality asks its most loaded neighbour for migratable parcels
+    /// if that neighbour has at least this many parcels queued.
+    boost::uint64_t steal_threshold;
+
+    /// The most parcels an idle locality asks for at once. The neighbour
+    /// gives away at most half of its migratable parcels.
+    boost::uint64_t steal_batch;
+
+    load_balancing_options()
+      : report_interval(1000)
+      , redirect_threshold(16)
+      , steal_threshold(2)
+      , steal_batch(16)
+    {}
+};
 
-struct runtime
+///////////////////////////////////////////////////////////////////////////////
+template <
+    typename Transport
+  , typename Serializer
+  , template <typename> class Queue
+    >
+struct basic_runtime : scheduler
 {
-    typedef std::map<asio_tcp::endpoint, std::shared_ptr<connection> >
+    typedef Transport transport_type;
+    typedef Serializer serializer_type;
+
+    typedef basic_action<basic_runtime> action_type;
+
+    typedef std::function<void(basic_runtime&)> function_type;
+
+    typedef typename Transport::template connection<basic_runtime>::type
+        connection_type;
+    typedef basic_tcp_connection<basic_runtime> tcp_connection_type;
+    typedef basic_loopback_connection<basic_runtime> loopback_connection_type;
+
+    typedef Queue<parcel*> parcel_queue_type;
+    typedef Queue<function_type*> local_queue_type;
+    typedef Queue<task*> ready_queue_type;
+
+    typedef std::map<boost::uint64_t, std::shared_ptr<connection_type> >
         connection_map;
 
+    typedef std::map<
+        asio_tcp::endpoint, std::shared_ptr<tcp_connection_type>
+    > endpoint_map;
+
+    typedef std::map<boost::uint64_t, boost::uint64_t> route_map;
+
+    typedef std::map<boost::uint64_t, boost::uint64_t> load_map;
+
   private:
+    // Whether our transport can establish TCP connections.
+    typedef typename std::is_base_of<
+        connection_type, tcp_connection_type
+    >::type tcp_enabled;
+
     asio::io_service io_service_;
 
     asio_tcp::acceptor acceptor_;
 
+    // Our TCP connections, by remote endpoint.
+    endpoint_map endpoints_;
+
+    // The id of this locality, which parcels use to address it.
+    boost::uint64_t locality_id_;
+
+    // Our direct neighbours (over any transport), by locality id, and the
+    // next hop to use for localities we are not directly connected to. These
+    // are read by the I/O thread when forwarding and by the execution thread
+    // when sending.
+    std::mutex connections_mtx_;
     connection_map connections_;
+    route_map routes_;
 
     std::thread exec_thread_;
 
-    boost::lockfree::queue<std::vector<char>*> parcel_queue_;
-    boost::lockfree::queue<std::function<void(runtime&)>*> local_queue_;
+    parcel_queue_type parcel_queue_;
+    local_queue_type local_queue_;
+
+    // Parcels for migratable actions, which the load balancer may still
+    // send elsewhere. Only used while load balancing. Executed after the
+    // parcels in parcel_queue_, except that one is taken at least every
+    // max_pinned_streak parcels, so that they can't starve.
+    parcel_queue_type migratable_queue_;
+
+    // The number of parcels in parcel_queue_ and migratable_queue_, and in
+    // migratable_queue_ alone.
+    std::atomic<boost::uint64_t> queued_parcels_;
+    std::atomic<boost::uint64_t> queued_migratable_;
+
+    static const std::size_t max_pinned_streak = 16;
+
+    // The number of parcels popped from parcel_queue_ since the last one
+    // from migratable_queue_. Only touched by the execution thread.
+    std::size_t pinned_streak_;
+
+    // Suspended tasks that are ready to be resumed. Tasks may be made ready
+    // from other threads (e.g. by an I/O handler fulfilling a promise).
+    ready_queue_type ready_queue_;
+
+    // All tasks ever created by this runtime, and the subset of them that
+    // have finished and can be reused. Only touched by the execution thread.
+    std::vector<std::unique_ptr<task> > tasks_;
+    std::vector<task*> free_tasks_;
+
+    // Set by a task right before it suspends; run by the execution thread
+    // once the task is off of its stack.
+    std::function<void(task*)> suspend_hook_;
+
+    std::size_t stack_size_;
+
+    // Whether we offer to exchange compact parcels with our neighbours.
+    bool compact_parcels_;
+
+    // Parcels (and their bytes, including headers) originated here.
+    std::atomic<boost::uint64_t> parcels_sent_;
+    std::atomic<boost::uint64_t> bytes_sent_;
+
+    // Parcels received here which were neither executed nor passed on, and
+    // whether we've reported one for an unknown action yet (only touched by
+    // the execution thread).
+    std::atomic<boost::uint64_t> parcels_dropped_;
+    bool reported_unknown_action_;
+
+    // If set, every parcel received from a neighbour is recorded here.
+    std::unique_ptr<parcel_log_writer> parcel_log_;
+
+    // Load balancing. Neighbours that balance too report their queue depth;
+    // we only move parcels to those. Reports are sent by the I/O thread.
+    bool load_balancing_;
+    load_balancing_options balancing_;
+    std::mutex loads_mtx_;
+    load_map neighbour_loads_;
+    asio::steady_timer load_timer_;
+    std::atomic<boost::uint64_t> last_reported_load_;
+
+    // Until when the execution thread waits for an answer to its last steal
+    // request before sending another one.
+    std::chrono::steady_clock::time_point steal_deadline_;
+
+    // Parcels which we sent to other localities instead of executing them.
+    std::atomic<boost::uint64_t> parcels_migrated_;
+
+    // Objects which actions refer to by id (see register_object).
+    std::mutex objects_mtx_;
+    std::map<boost::uint64_t, std::shared_ptr<void> > objects_;
+    boost::uint64_t next_object_;
 
     std::atomic<bool> stop_flag_;
 
-    std::function<void(runtime&)> main_;
+    function_type main_;
 
     // The # of clients to wait for before executing main_.
-    boost::uint64_t wait_for_; 
+    boost::uint64_t wait_for_;
 
   public:
-    runtime(
+    /// The size of the stack of each task. Actions (and the loads of their
+    /// parcels) run on these; a task which overflows its stack faults on a
+    /// guard page.
+    static const std::size_t default_stack_size = 64 * 1024;
+
+    /// If port is empty, or our transport has no TCP connections, the
+    /// runtime does not listen for TCP connections, and can only be
+    /// connected to other runtimes in the same process.
+    basic_runtime(
         std::string port
-      , std::function<void(runtime&)> f = std::function<void(runtime&)>() 
-      , boost::uint64_t wait_for = 1 
+      , function_type f = function_type()
+      , boost::uint64_t wait_for = 1
+      , std::size_t stack_size = default_stack_size
         )
       : io_service_()
-      , acceptor_(io_service_, asio_tcp::endpoint(asio_tcp::v4(),
-            boost::lexical_cast<boost::uint16_t>(port))) 
+      , acceptor_(io_service_)
+      , endpoints_()
+      , locality_id_(port.empty() ? next_loopback_id()
+                                  : boost::lexical_cast<boost::uint16_t>(port))
+      , connections_mtx_()
       , connections_()
+      , routes_()
       , exec_thread_()
       , parcel_queue_(64) // Pre-allocate some nodes.
       , local_queue_(64) // Pre-allocate some nodes.
+      , migratable_queue_(64) // Pre-allocate some nodes.
+      , queued_parcels_(0)
+      , queued_migratable_(0)
+      , pinned_streak_(0)
+      , ready_queue_(64) // Pre-allocate some nodes.
+      , tasks_()
+      , free_tasks_()
+      , suspend_hook_()
+      , stack_size_(stack_size)
+      , compact_parcels_(false)
+      , parcels_sent_(0)
+      , bytes_sent_(0)
+      , parcels_dropped_(0)
+      , reported_unknown_action_(false)
+      , parcel_log_()
+      , load_balancing_(false)
+      , balancing_()
+      , loads_mtx_()
+      , neighbour_loads_()
+      , load_timer_(io_service_)
+      , last_reported_load_(no_load_reported)
+      , steal_deadline_()
+      , parcels_migrated_(0)
+      , objects_mtx_()
+      , objects_()
+      , next_object_(0)
       , stop_flag_(false)
       , main_(f)
-      , wait_for_(wait_for) 
+      , wait_for_(wait_for)
     {
         BOOST_ASSERT(wait_for != 0);
+
+        if (!port.empty() && tcp_enabled::value)
+        {
+            asio_tcp::endpoint ep(asio_tcp::v4()
+                                , boost::lexical_cast<boost::uint16_t>(port));
+
+            acceptor_.open(ep.protocol());
+            acceptor_.set_option(asio_tcp::acceptor::reuse_address(true));
+            acceptor_.bind(ep);
+            acceptor_.listen();
+        }
     }
 
-    ~runtime()
+    ~basic_runtime()
     {
         stop();
     }
@@ -78,35 +336,229 @@ struct runtime
         return io_service_;
     }
 
-    boost::lockfree::queue<std::vector<char>*>& get_parcel_queue()
+    parcel_queue_type& get_parcel_queue()
     {
         return parcel_queue_;
     }
 
-    boost::lockfree::queue<std::function<void(runtime&)>*>& get_local_queue()
+    local_queue_type& get_local_queue()
     {
         return local_queue_;
     }
 
-    connection_map& get_connections()
+    /// Returns a snapshot of our direct neighbours, by locality id.
+    connection_map get_connections()
     {
+        std::lock_guard<std::mutex> l(connections_mtx_);
         return connections_;
     }
 
+    /// By default, the id of a locality is the port it listens on (or a
+    /// unique id above the port range, if it doesn't listen). When localities
+    /// on different hosts share a port, unique ids must be set explicitly
+    /// before calling start() or connect().
+    boost::uint64_t get_locality_id() const
+    {
+        return locality_id_;
+    }
+
+    void set_locality_id(boost::uint64_t id)
+    {
+        locality_id_ = id;
+    }
+
+    /// When enabled, neighbours which also enable it and use the same archive
+    /// version agree to send each other compact parcels: only the body of
+    /// actions registered with REGISTER_ACTION, with no archive header or
+    /// class metadata. Must be set before connecting.
+    bool get_compact_parcels() const
+    {
+        return compact_parcels_;
+    }
+
+    void set_compact_parcels(bool enable)
+    {
+        compact_parcels_ = enable;
+    }
+
+    boost::uint64_t get_parcels_sent() const
+    {
+        return parcels_sent_.load();
+    }
+
+    boost::uint64_t get_bytes_sent() const
+    {
+        return bytes_sent_.load();
+    }
+
+    /// The number of parcels we received but dropped: compact parcels for
+    /// action ids we have no registered action for (usually a sign that the
+    /// localities were built with different actions or GUIDs), and parcels
+    /// we had no route for, or which ran out of hops.
+    boost::uint64_t get_parcels_dropped() const
+    {
+        return parcels_dropped_.load();
+    }
+
+    /// When enabled, we tell our neighbours how many parcels we have queued,
+    /// and move parcels for migratable actions (see is_migratable()) between
+    /// us and the neighbours which enable it too: while we're overloaded,
+    /// such parcels that arrive for us are redirected, undeserialized, to the
+    /// least loaded neighbour, and when we run out of work, we ask the most
+    /// loaded neighbour for some of its queued ones. Must be set before
+    /// calling start().
+    void set_load_balancing(
+        bool enable
+      , load_balancing_options const& options = load_balancing_options()
+        )
+    {
+        load_balancing_ = enable;
+        balancing_ = options;
+    }
+
+    bool get_load_balancing() const
+    {
+        return load_balancing_;
+    }
+
+    /// The number of received parcels waiting to be executed.
+    boost::uint64_t get_queue_depth() const
+    {
+        return queued_parcels_.load();
+    }
+
+    /// The number of parcels which we handed to neighbours to execute,
+    /// instead of executing them ourselves.
+    boost::uint64_t get_parcels_migrated() const
+    {
+        return parcels_migrated_.load();
+    }
+
+    /// Returns the queue depths our neighbours last reported, by locality id.
+    load_map get_neighbour_loads()
+    {
+        std::lock_guard<std::mutex> l(loads_mtx_);
+        return neighbour_loads_;
+    }
+
+    /// Record every parcel received from a neighbour (including ones we only
+    /// forward) in a parcel log at path, so that the traffic can be replayed
+    /// later with replay_parcels. Must be set before connecting.
+    void set_parcel_log(std::string const& path)
+    {
+        parcel_log_.reset(new parcel_log_writer(path, locality_id_));
+    }
+
+    /// Feed the parcels recorded in log into our parcel queue, as if they had
+    /// just arrived, either at the pace they were recorded at or as fast as
+    /// possible. Parcels are queued for execution here whatever locality they
+    /// were addressed to. Blocks until all of them are queued; must not be
+    /// called from the execution thread. Returns the number of parcels.
+    /// Throws std::ios_base::failure if the log is damaged; the parcels
+    /// before the damaged record have been queued by then.
+    boost::uint64_t replay_parcels(
+        parcel_log_reader& log
+      , bool original_speed
+        );
+
+    /// Returns an object id which is unique across all localities (as long
+    /// as locality ids fit into 32 bits).
+    boost::uint64_t new_object_id()
+    {
+        std::lock_guard<std::mutex> l(objects_mtx_);
+        return (locality_id_ << 32) | ++next_object_;
+    }
+
+    /// Make obj available to actions executed here, by id. Actions use this
+    /// to refer to state kept on a locality, e.g. the segments of a
+    /// partitioned_vector, or a gather waiting for replies.
+    void register_object(boost::uint64_t id, std::shared_ptr<void> obj)
+    {
+        std::lock_guard<std::mutex> l(objects_mtx_);
+        objects_[id] = obj;
+    }
+
+    void unregister_object(boost::uint64_t id)
+    {
+        std::lock_guard<std::mutex> l(objects_mtx_);
+        objects_.erase(id);
+    }
+
+    /// Returns the object registered with id, or an empty pointer. T must be
+    /// the type it was registered as.
+    template <typename T>
+    std::shared_ptr<T> get_object(boost::uint64_t id)
+    {
+        std::lock_guard<std::mutex> l(objects_mtx_);
+
+        std::map<boost::uint64_t, std::shared_ptr<void> >::iterator it
+            = objects_.find(id);
+
+        if (it == objects_.end())
+            return std::shared_ptr<T>();
+
+        return std::static_pointer_cast<T>(it->second);
+    }
+
+    /// Route parcels for destination through the neighbour next_hop.
+    void add_route(boost::uint64_t destination, boost::uint64_t next_hop)
+    {
+        std::lock_guard<std::mutex> l(connections_mtx_);
+        routes_[destination] = next_hop;
+    }
+
+    /// Returns the neighbour through which parcels for destination should be
+    /// sent, or an empty pointer if there is no route.
+    std::shared_ptr<connection_type> get_next_hop(boost::uint64_t destination);
+
+    /// Asynchronously send an action to a locality, which need not be a
+    /// direct neighbour. If destination is this locality, the action is
+    /// queued to run here, after any writes queued before it.
+    void async_write(
+        boost::uint64_t destination
+      , action_type const& act
+      , std::function<void(error_code const&)> handler
+          = std::function<void(error_code const&)>()
+        );
+
     /// Launch the execution thread. Then, start accepting connections.
-    void start(); 
+    void start();
 
-    /// Stop the I/O service and execution thread. 
+    /// Stop the I/O service and execution thread.
     void stop();
 
-    /// Accepts connections and parcels until stop() is called. 
+    /// Accepts connections and parcels until stop() is called.
     void run();
 
-    /// Connect to another node. 
-    std::shared_ptr<connection> connect(
+    /// Connect to another node. Requires a transport with TCP connections.
+    std::shared_ptr<connection_type> connect(
         std::string host
       , std::string port
-        ); 
+        );
+
+    /// Connect to another runtime in the same process. Parcels are exchanged
+    /// through memory instead of sockets. other acts as the accepting side,
+    /// so its main is run once it has enough neighbours. Requires a transport
+    /// with loopback connections.
+    std::shared_ptr<connection_type> connect(basic_runtime& other);
+
+    /// Suspend the calling task. Once the task is off of its stack, the
+    /// execution thread calls hook with it; the hook is responsible for
+    /// arranging for resume() to be called eventually. Must be called from
+    /// inside a task.
+    void suspend(std::function<void(task*)> hook);
+
+    /// Suspend the calling task and put it at the back of the ready queue,
+    /// giving other tasks a chance to run. Must be called from inside a task.
+    void yield();
+
+    /// Make a suspended task ready to run again. Can be called from any
+    /// thread.
+    void resume(task* t)
+    {
+        BOOST_ASSERT(t);
+        ready_queue_.push(t);
+    }
 
     /// Asynchronously accept a new connection.
     void async_accept();
@@ -114,41 +566,230 @@ struct runtime
     /// Handler for new connections.
     void handle_accept(
         error_code const& error
-      , std::shared_ptr<connection> conn
+      , std::shared_ptr<tcp_connection_type> conn
         );
 
   private:
-    friend struct connection;
+    friend struct basic_connection<basic_runtime>;
+    friend struct basic_tcp_connection<basic_runtime>;
+    friend struct basic_loopback_connection<basic_runtime>;
+
+    // last_reported_load_ before our first report.
+    static const boost::uint64_t no_load_reported = ~boost::uint64_t(0);
+
+    static boost::uint64_t next_loopback_id()
+    {
+        static std::atomic<boost::uint64_t> next(boost::uint64_t(1) << 16);
+        return next++;
+    }
+
+    /// Start accepting connections, if our transport has TCP connections.
+    void start_accepting(std::true_type)
+    {
+        async_accept();
+    }
 
-    /// Execute actions until stop() is called. 
+    void start_accepting(std::false_type) {}
+
+    /// Execute actions until stop() is called.
     void exec_loop();
 
-    /// Serializes a action object into a parcel.
-    std::vector<char>* serialize_parcel(action const& act);
+    /// Run f in a new (or recycled) task.
+    void spawn(task::function_type f);
+
+    /// Resume t until it finishes or suspends.
+    void run_task(task* t);
+
+    /// Called once the locality id of a new neighbour is known.
+    void add_locality(std::shared_ptr<connection_type> conn);
+
+    /// If main exists and we have enough clients to run it, schedule it.
+    void check_main();
+
+    /// Queue act to be serialized and written to conn by the execution
+    /// thread.
+    void post_write(
+        std::shared_ptr<connection_type> const& conn
+      , boost::uint64_t destination
+      , action_type const& act
+      , std::function<void(error_code const&)> const& handler
+        );
+
+    /// This function is scheduled in the local_queue by post_write. It does
+    /// the actual work of serializing the action.
+    void write_worker(
+        std::shared_ptr<connection_type> conn
+      , boost::uint64_t destination
+      , std::shared_ptr<action_type> act
+      , std::function<void(error_code const&)> handler
+        );
+
+    /// Called by the transports when a parcel arrives from source, before
+    /// delivering it. Control parcels aren't recorded.
+    void record_parcel(boost::uint64_t source, parcel const& p)
+    {
+        if (parcel_log_ && !(p.header.flags & parcel_header::control))
+            parcel_log_->append(source, p.header, p.payload.data());
+    }
+
+    /// Queue a parcel addressed to us for execution.
+    void queue_parcel(parcel* p);
+
+    /// Take the next parcel to execute off of our queues.
+    bool pop_parcel(parcel*& p);
+
+    /// Send a control parcel to the neighbour locality. Called by the I/O
+    /// thread.
+    void send_control(
+        boost::uint64_t locality
+      , parcel_header::flag_type type
+      , boost::uint64_t value
+        );
+
+    /// Handle a control parcel from a neighbour.
+    void receive_control(parcel const& p);
+
+    /// Tell our neighbours our queue depth, if it changed since the last
+    /// time, and schedule the next report.
+    void report_load(error_code const& error);
+
+    /// If we are overloaded, send the migratable parcel p to the least loaded
+    /// neighbour, and return true.
+    bool redirect_parcel(parcel* p);
+
+    /// Called by the execution thread when it has nothing to do. Asks the
+    /// most loaded neighbour for work, unless we're waiting for an answer.
+    void request_steal();
+
+    /// Give up to count of our migratable parcels to the neighbour thief.
+    void handle_steal_request(boost::uint64_t thief, boost::uint64_t count);
+
+    /// Hand a parcel which was addressed to us to the neighbour conn instead.
+    /// Returns false if conn can't take it.
+    bool migrate_parcel(
+        parcel* p
+      , std::shared_ptr<connection_type> const& conn
+        );
+
+    /// Called by the transports when a parcel arrives. Queues it for
+    /// execution if it is addressed to us, otherwise forwards it.
+    void deliver_parcel(parcel* p);
+
+    /// Pass on a parcel that is addressed to another locality.
+    void forward_parcel(
+        parcel_header header
+      , std::shared_ptr<std::vector<char> > payload
+        );
+};
+
+/// A connection to a neighbouring locality. Transports derive from this and
+/// implement async_write_parcel; incoming parcels are handed to
+/// Runtime::deliver_parcel.
+template <typename Runtime>
+struct basic_connection
+  : std::enable_shared_from_this<basic_connection<Runtime> >
+{
+    typedef typename Runtime::action_type action_type;
+
+  protected:
+    Runtime& runtime_;
+
+    // The locality id of the node on the other end.
+    boost::uint64_t peer_locality_;
+
+    // Whether both ends agreed to exchange compact parcels.
+    bool compact_;
+
+  public:
+    basic_connection(Runtime& s)
+      : runtime_(s)
+      , peer_locality_(0)
+      , compact_(false)
+    {}
+
+    virtual ~basic_connection() {}
+
+    boost::uint64_t get_locality() const
+    {
+        return peer_locality_;
+    }
+
+    bool is_compact() const
+    {
+        return compact_;
+    }
+
+    /// Asynchronously write a action to the other end.
+    void async_write(action_type const& act)
+    {
+        std::function<void(error_code const&)> h;
+        async_write(act, h);
+    }
+
+    /// Asynchronously write a action to the other end.
+    void async_write(
+        action_type const& act
+      , std::function<void(error_code const&)> handler
+        );
 
-    /// Deserializes a parcel into a action object.
-    action* deserialize_parcel(std::vector<char>& raw_msg);
+    /// Asynchronously write an already serialized parcel to the other end.
+    /// Parcels are sent from the execution thread as well as from the I/O
+    /// threads (forwarded, control, stolen and migrated parcels), so
+    /// implementations must allow concurrent calls, and keep the parcels
+    /// from each thread in order.
+    virtual void async_write_parcel(
+        parcel_header const& header
+      , std::shared_ptr<std::vector<char> > payload
+      , std::function<void(error_code const&)> handler
+        ) = 0;
 };
 
-struct connection : std::enable_shared_from_this<connection>
+/// A connection over a TCP socket.
+template <typename Runtime>
+struct basic_tcp_connection final : basic_connection<Runtime>
 {
   private:
-    runtime& runtime_;
+    using basic_connection<Runtime>::runtime_;
+    using basic_connection<Runtime>::peer_locality_;
+    using basic_connection<Runtime>::compact_;
+
+    /// An encoded parcel waiting to be written.
+    struct outgoing_parcel
+    {
+        std::shared_ptr<parcel_header::buffer_type> header;
+        std::shared_ptr<std::vector<char> > payload;
+        std::function<void(error_code const&)> handler;
+    };
+
+    // The most queued parcels that are gathered into a single write.
+    static const std::size_t max_gathered_parcels = 64;
 
     asio_tcp::socket socket_;
 
-    boost::uint64_t in_size_;
-    std::vector<char>* in_buffer_;
+    parcel_header::buffer_type in_header_buffer_;
+    parcel* in_parcel_;
+
+    // Parcels are written by the execution thread and (when forwarding or
+    // balancing load) the I/O thread, but a socket must only have one write
+    // in flight. So every write is queued on strand_, which also runs the
+    // write handler; the first out_in_flight_ parcels of out_queue_ are
+    // being written.
+    asio::io_service::strand strand_;
+    std::deque<outgoing_parcel> out_queue_;
+    std::size_t out_in_flight_;
 
   public:
-    connection(runtime& s)
-      : runtime_(s)
+    basic_tcp_connection(Runtime& s)
+      : basic_connection<Runtime>(s)
       , socket_(s.get_io_service())
-      , in_size_(0)
-      , in_buffer_()
+      , in_header_buffer_()
+      , in_parcel_()
+      , strand_(s.get_io_service())
+      , out_queue_()
+      , out_in_flight_(0)
     {}
 
-    ~connection();
+    ~basic_tcp_connection();
 
     asio_tcp::socket& get_socket()
     {
@@ -160,47 +801,122 @@ struct connection : std::enable_shared_from_this<connection>
         return socket_.remote_endpoint();
     }
 
+    /// Send our handshake to the other end. This is the first thing that
+    /// is written to a new connection.
+    void write_hello();
+
+    /// Synchronously read the handshake of the other end.
+    void read_hello();
+
+    /// Asynchronously read the handshake of the other end, then start
+    /// reading parcels.
+    void async_read_hello();
+
+    /// Handler for the handshake.
+    void handle_read_hello(
+        error_code const& error
+      , std::shared_ptr<handshake::buffer_type> buf
+        );
+
+    /// Agree on what we and the other end can do.
+    void negotiate(handshake::buffer_type const& buf);
+
     /// Asynchronously read a parcel from the socket.
     void async_read();
 
-    /// Handler for the parcel size.
-    void handle_read_size(error_code const& error);
+    /// Handler for the parcel header.
+    void handle_read_header(error_code const& error);
 
     /// Handler for the data.
     void handle_read_data(error_code const& error);
 
-    /// Asynchronously write a action to the socket. 
-    void async_write(action const& act)
+    /// Asynchronously write an already serialized parcel to the socket.
+    /// Can be called from any thread; parcels are written in the order they
+    /// are queued.
+    void async_write_parcel(
+        parcel_header const& header
+      , std::shared_ptr<std::vector<char> > payload
+      , std::function<void(error_code const&)> handler
+        );
+
+  private:
+    /// Add a parcel to the outgoing queue, and start writing if no write is
+    /// in flight. Runs on strand_.
+    void queue_write(outgoing_parcel const& out);
+
+    /// Write the parcels at the front of the outgoing queue. Runs on strand_.
+    void start_write();
+
+    /// Write handler. Runs on strand_.
+    void handle_write(error_code const& error);
+
+    /// Give up on a connection whose peer sent something we can't read.
+    void close(char const* reason);
+
+    std::shared_ptr<basic_tcp_connection> shared_this()
     {
-        std::function<void(error_code const&)> h;
-        async_write(act, h);
-    } 
+        return std::static_pointer_cast<basic_tcp_connection>(
+            this->shared_from_this());
+    }
+};
 
-    /// Asynchronously write a action to the socket. 
-    void async_write(
-        action const& act
-      , std::function<void(error_code const&)> handler
-        ); 
+/// A connection to another runtime in the same process. Writing a parcel
+/// hands a copy of it directly to the other runtime, without any sockets.
+template <typename Runtime>
+struct basic_loopback_connection final : basic_connection<Runtime>
+{
+  private:
+    using basic_connection<Runtime>::runtime_;
+    using basic_connection<Runtime>::peer_locality_;
+    using basic_connection<Runtime>::compact_;
 
-    /// This function is scheduled in the local_queue by async_write. It does
-    /// the actual work of serializing the action.
-    void async_write_worker(
-        std::shared_ptr<action> act
-      , std::function<void(error_code const&)> handler
-        );
+    // The other end. Both ends are owned by their runtimes' connection maps,
+    // so we don't keep the peer alive ourselves.
+    std::weak_ptr<basic_loopback_connection> peer_;
 
-    /// Write handler.
-    void handle_write(
-        error_code const& error
-      , std::shared_ptr<boost::uint64_t> out_size 
-      , std::shared_ptr<std::vector<char> > out_buffer
-      , std::function<void(error_code const&)> handler
+  public:
+    basic_loopback_connection(Runtime& s)
+      : basic_connection<Runtime>(s)
+      , peer_()
+    {}
+
+    /// Connect a and b to each other.
+    static void pair(
+        std::shared_ptr<basic_loopback_connection> const& a
+      , std::shared_ptr<basic_loopback_connection> const& b
         )
     {
-        if (handler)
-            handler(error);
+        // Both ends are in the same process, so they always use the same
+        // archive version.
+        bool compact = a->runtime_.get_compact_parcels()
+                    && b->runtime_.get_compact_parcels();
+
+        a->peer_ = b;
+        a->peer_locality_ = b->runtime_.get_locality_id();
+        a->compact_ = compact;
+        b->peer_ = a;
+        b->peer_locality_ = a->runtime_.get_locality_id();
+        b->compact_ = compact;
     }
+
+    /// Hand a copy of the parcel to the other runtime.
+    void async_write_parcel(
+        parcel_header const& header
+      , std::shared_ptr<std::vector<char> > payload
+      , std::function<void(error_code const&)> handler
+        );
 };
 
-#endif
+typedef basic_connection<runtime> connection;
+typedef basic_tcp_connection<runtime> tcp_connection;
+typedef basic_loopback_connection<runtime> loopback_connection;
+
+// The default configuration is instantiated in runtime.cpp.
+extern template struct basic_runtime<
+    any_transport, iostream_serializer, lockfree_queue
+>;
+extern template struct basic_connection<runtime>;
+extern template struct basic_tcp_connection<runtime>;
+extern template struct basic_loopback_connection<runtime>;
 
+#endif
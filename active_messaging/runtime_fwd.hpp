@@ -0,0 +1,39 @@
+// Copyright (c) 2012-2013 Bryce Adelstein-Lelbach
+// Copyright (c) 2012-2013 Hartmut Kaiser
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+#if !defined(CPPNOW_A758CD8C_CED4_4CCF_9E2E_26C78EF88B72)
+#define CPPNOW_A758CD8C_CED4_4CCF_9E2E_26C78EF88B72
+
+// Transport policies (runtime.hpp).
+struct any_transport;
+struct tcp_transport;
+struct loopback_transport;
+
+// Serializer policies (serializers.hpp).
+struct iostream_serializer;
+struct streambuf_serializer;
+
+// Queue policies (queues.hpp).
+template <typename T>
+struct lockfree_queue;
+
+template <typename T>
+struct locked_queue;
+
+template <
+    typename Transport
+  , typename Serializer
+  , template <typename> class Queue
+    >
+struct basic_runtime;
+
+/// The runtime used by default: any mix of TCP and loopback connections,
+/// Boost binary archives written through an iostream, and lock-free queues.
+typedef basic_runtime<any_transport, iostream_serializer, lockfree_queue>
+    runtime;
+
+#endif
+
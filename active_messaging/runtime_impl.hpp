@@ -0,0 +1,1311 @@
+// Copyright (c) 2012-2013 Bryce Adelstein-Lelbach
+// Copyright (c) 2012-2013 Hartmut Kaiser
+// Copyright (c) 2003-2013 Christopher M. Kohlhoff (chris at kohlhoff dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+#if !defined(CPPNOW_9A663A63_6FB7_4FFA_B780_CA51335804A7)
+#define CPPNOW_9A663A63_6FB7_4FFA_B780_CA51335804A7
+
+// The definitions of the members of basic_runtime and its connections. Only
+// needed by programs which instantiate basic_runtime with their own policies.
+
+#include <iostream>
+
+#include <boost/scoped_ptr.hpp>
+#include <boost/archive/binary_oarchive.hpp>
+
+#include "runtime.hpp"
+#include "serializers.hpp"
+#include "action_registry.hpp"
+
+///////////////////////////////////////////////////////////////////////////////
+// basic_runtime
+
+template <
+    typename Transport
+  , typename Serializer
+  , template <typename> class Queue
+    >
+void basic_runtime<Transport, Serializer, Queue>::start()
+{
+    // Start the execution thread.
+    exec_thread_ = std::thread(boost::bind(&basic_runtime::exec_loop
+                                         , boost::ref(*this)));
+
+    // Start reporting our load, from the I/O thread.
+    if (load_balancing_)
+        io_service_.post(boost::bind(&basic_runtime::report_load
+                                   , boost::ref(*this), error_code()));
+
+    // Runtimes that only talk to other runtimes in the same process don't
+    // listen on a port.
+    if (!acceptor_.is_open())
+        return;
+
+    // Set up acceptor.
+    acceptor_.set_option(asio_tcp::acceptor::reuse_address(true));
+    acceptor_.set_option(asio_tcp::acceptor::linger(true, 0));
+
+    // Start accepting connections.
+    start_accepting(tcp_enabled());
+}
+
+template <
+    typename Transport
+  , typename Serializer
+  , template <typename> class Queue
+    >
+void basic_runtime<Transport, Serializer, Queue>::stop()
+{
+    // Tell the execution thread to stop.
+    stop_flag_.store(true);
+
+    // Destroy the keep-alive work object, which will cause run() to return
+    // when all I/O work is done.
+    io_service_.stop();
+}
+
+template <
+    typename Transport
+  , typename Serializer
+  , template <typename> class Queue
+    >
+void basic_runtime<Transport, Serializer, Queue>::run()
+{
+    // Keep io_service::run() from returning.
+    asio::io_service::work work(io_service_);
+
+    io_service_.run();
+
+    if (exec_thread_.joinable())
+        exec_thread_.join();
+}
+
+template <
+    typename Transport
+  , typename Serializer
+  , template <typename> class Queue
+    >
+std::shared_ptr<
+    typename basic_runtime<Transport, Serializer, Queue>::connection_type
+>
+basic_runtime<Transport, Serializer, Queue>::connect(
+    std::string host
+  , std::string port
+    )
+{
+    static_assert(tcp_enabled::value
+                , "the transport of this runtime has no TCP connections");
+
+    asio_tcp::resolver resolver(io_service_);
+    asio_tcp::resolver::query query(asio_tcp::v4(), host, port);
+
+    asio_tcp::resolver::iterator it = resolver.resolve(query);
+    asio_tcp::resolver::iterator end;
+
+    for (asio_tcp::resolver::iterator i = it; i != end; ++i)
+        if (endpoints_.count(*i) != 0)
+            return endpoints_[*i];
+
+    std::shared_ptr<tcp_connection_type> conn(new tcp_connection_type(*this));
+
+    // Waits for up to 6.4 seconds (0.001 * 100 * 64) for the runtime to become
+    // available.
+    for (boost::uint64_t i = 0; i < 64; ++i)
+    {
+        error_code ec;
+        asio::connect(conn->get_socket(), it, ec);
+        if (!ec) break;
+
+        // Otherwise, we sleep and try again.
+        std::chrono::milliseconds period(100);
+        std::this_thread::sleep_for(period);
+    }
+
+    conn->get_socket().set_option(asio_tcp::socket::reuse_address(true));
+    conn->get_socket().set_option(asio_tcp::socket::linger(true, 0));
+
+    // Exchange locality ids. We do this synchronously, so that the caller
+    // can address the new neighbour as soon as we return.
+    conn->write_hello();
+    conn->read_hello();
+
+    // Note that if we had multiple I/O threads, we would have to lock
+    // before touching the map.
+    asio_tcp::endpoint ep = conn->get_remote_endpoint();
+    BOOST_ASSERT(endpoints_.count(ep) == 0);
+
+    endpoints_[ep] = conn;
+
+    add_locality(conn);
+
+    // Start reading.
+    conn->async_read();
+
+    return conn;
+}
+
+template <
+    typename Transport
+  , typename Serializer
+  , template <typename> class Queue
+    >
+std::shared_ptr<
+    typename basic_runtime<Transport, Serializer, Queue>::connection_type
+>
+basic_runtime<Transport, Serializer, Queue>::connect(basic_runtime& other)
+{
+    static_assert(
+        std::is_base_of<connection_type, loopback_connection_type>::value
+      , "the transport of this runtime has no loopback connections");
+
+    BOOST_ASSERT(&other != this);
+    BOOST_ASSERT(other.get_locality_id() != get_locality_id());
+
+    std::shared_ptr<loopback_connection_type>
+        conn(new loopback_connection_type(*this));
+    std::shared_ptr<loopback_connection_type>
+        other_conn(new loopback_connection_type(other));
+
+    loopback_connection_type::pair(conn, other_conn);
+
+    add_locality(conn);
+
+    other.add_locality(other_conn);
+    other.check_main();
+
+    return conn;
+}
+
+template <
+    typename Transport
+  , typename Serializer
+  , template <typename> class Queue
+    >
+void basic_runtime<Transport, Serializer, Queue>::async_accept()
+{
+    std::shared_ptr<tcp_connection_type> conn;
+    conn.reset(new tcp_connection_type(*this));
+
+    acceptor_.async_accept(conn->get_socket(),
+        boost::bind(&basic_runtime::handle_accept
+                  , boost::ref(*this)
+                  , asio::placeholders::error
+                  , conn));
+}
+
+template <
+    typename Transport
+  , typename Serializer
+  , template <typename> class Queue
+    >
+void basic_runtime<Transport, Serializer, Queue>::handle_accept(
+    error_code const& error
+  , std::shared_ptr<tcp_connection_type> conn
+    )
+{
+    if (!error)
+    {
+        // If there was no error, then we need to insert conn into the
+        // the connection table, but first we want to set up the next
+        // async_accept.
+        std::shared_ptr<tcp_connection_type> old_conn(conn);
+
+        conn.reset(new tcp_connection_type(*this));
+
+        acceptor_.async_accept(conn->get_socket(),
+            boost::bind(&basic_runtime::handle_accept
+                      , boost::ref(*this)
+                      , asio::placeholders::error
+                      , conn));
+
+        // Note that if we had multiple I/O threads, we would have to lock
+        // before touching the map.
+        asio_tcp::endpoint ep = old_conn->get_remote_endpoint();
+        BOOST_ASSERT(endpoints_.count(ep) == 0);
+
+        endpoints_[ep] = old_conn;
+
+        // Tell the other end who we are, then find out who they are. main_
+        // is checked once we know, so that it can address the new neighbour.
+        old_conn->write_hello();
+        old_conn->async_read_hello();
+    }
+}
+
+template <
+    typename Transport
+  , typename Serializer
+  , template <typename> class Queue
+    >
+void basic_runtime<Transport, Serializer, Queue>::check_main()
+{
+    std::size_t neighbours = 0;
+
+    {
+        std::lock_guard<std::mutex> l(connections_mtx_);
+        neighbours = connections_.size();
+    }
+
+    // If main exists, do we have enough clients to run it?
+    if (main_ && (neighbours >= wait_for_))
+    {
+        // Instead of running main_ directly, we will stick it in the
+        // action queue.
+        local_queue_.push(new function_type(main_));
+    }
+}
+
+template <
+    typename Transport
+  , typename Serializer
+  , template <typename> class Queue
+    >
+void basic_runtime<Transport, Serializer, Queue>::add_locality(
+    std::shared_ptr<connection_type> conn
+    )
+{
+    {
+        std::lock_guard<std::mutex> l(connections_mtx_);
+        connections_[conn->get_locality()] = conn;
+    }
+
+    // Make sure the new neighbour hears about our load.
+    last_reported_load_.store(no_load_reported);
+}
+
+template <
+    typename Transport
+  , typename Serializer
+  , template <typename> class Queue
+    >
+std::shared_ptr<
+    typename basic_runtime<Transport, Serializer, Queue>::connection_type
+>
+basic_runtime<Transport, Serializer, Queue>::get_next_hop(
+    boost::uint64_t destination
+    )
+{
+    std::lock_guard<std::mutex> l(connections_mtx_);
+
+    typename connection_map::iterator it = connections_.find(destination);
+
+    if (it != connections_.end())
+        return it->second;
+
+    // We aren't directly connected, so see if we know someone who can get
+    // the parcel closer.
+    route_map::iterator r = routes_.find(destination);
+
+    if (r != routes_.end())
+    {
+        it = connections_.find(r->second);
+        if (it != connections_.end())
+            return it->second;
+    }
+
+    return std::shared_ptr<connection_type>();
+}
+
+template <
+    typename Transport
+  , typename Serializer
+  , template <typename> class Queue
+    >
+void basic_runtime<Transport, Serializer, Queue>::async_write(
+    boost::uint64_t destination
+  , action_type const& act
+  , std::function<void(error_code const&)> handler
+    )
+{
+    if (destination == locality_id_)
+    {
+        std::shared_ptr<action_type> act_ptr(act.clone());
+
+        local_queue_.push(new function_type(
+            [act_ptr](basic_runtime& rt)
+            {
+                (*act_ptr)(rt);
+            }));
+
+        if (handler)
+            io_service_.post(boost::bind(handler, error_code()));
+        return;
+    }
+
+    std::shared_ptr<connection_type> conn = get_next_hop(destination);
+
+    if (!conn)
+    {
+        if (handler)
+            handler(asio::error::host_unreachable);
+        return;
+    }
+
+    post_write(conn, destination, act, handler);
+}
+
+template <
+    typename Transport
+  , typename Serializer
+  , template <typename> class Queue
+    >
+void basic_runtime<Transport, Serializer, Queue>::post_write(
+    std::shared_ptr<connection_type> const& conn
+  , boost::uint64_t destination
+  , action_type const& act
+  , std::function<void(error_code const&)> const& handler
+    )
+{
+    std::shared_ptr<action_type> act_ptr(act.clone());
+
+    local_queue_.push(new function_type(
+        boost::bind(&basic_runtime::write_worker
+                  , _1, conn, destination, act_ptr, handler)));
+}
+
+template <
+    typename Transport
+  , typename Serializer
+  , template <typename> class Queue
+    >
+void basic_runtime<Transport, Serializer, Queue>::write_worker(
+    std::shared_ptr<connection_type> conn
+  , boost::uint64_t destination
+  , std::shared_ptr<action_type> act
+  , std::function<void(error_code const&)> handler
+    )
+{
+    parcel_header header;
+    header.destination = destination;
+    header.action_id = get_action_id(*act);
+
+    // Compact parcels are only understood by neighbours which agreed to
+    // receive them, so parcels that are routed further use the full format.
+    bool compact = conn->is_compact()
+                && (destination == conn->get_locality())
+                && get_action_serializer<action_type>(header.action_id);
+
+    if (compact)
+        header.flags |= parcel_header::compact;
+
+    if (act->is_migratable())
+        header.flags |= parcel_header::migratable;
+
+    std::shared_ptr<std::vector<char> >
+        out_buffer(Serializer::serialize(*act, compact));
+
+    header.payload_size = out_buffer->size();
+
+    ++parcels_sent_;
+    bytes_sent_ += parcel_header::size + out_buffer->size();
+
+    conn->async_write_parcel(header, out_buffer, handler);
+}
+
+template <
+    typename Transport
+  , typename Serializer
+  , template <typename> class Queue
+    >
+void basic_runtime<Transport, Serializer, Queue>::deliver_parcel(parcel* p)
+{
+    BOOST_ASSERT(p);
+
+    // Control parcels are handled right away, so that load information is
+    // never stuck behind the work it describes.
+    if (p->header.flags & parcel_header::control)
+    {
+        boost::scoped_ptr<parcel> ctl(p);
+        receive_control(*ctl);
+        return;
+    }
+
+    // Only the destination deserializes the parcel; everyone else just
+    // passes it on.
+    if (p->header.destination == locality_id_)
+    {
+        if (!redirect_parcel(p))
+            queue_parcel(p);
+        return;
+    }
+
+    boost::scoped_ptr<parcel> fwd(p);
+
+    std::shared_ptr<std::vector<char> > payload(new std::vector<char>());
+    payload->swap(fwd->payload);
+
+    forward_parcel(fwd->header, payload);
+}
+
+template <
+    typename Transport
+  , typename Serializer
+  , template <typename> class Queue
+    >
+boost::uint64_t basic_runtime<Transport, Serializer, Queue>::replay_parcels(
+    parcel_log_reader& log
+  , bool original_speed
+    )
+{
+    boost::uint64_t count = 0;
+
+    std::chrono::steady_clock::time_point start =
+        std::chrono::steady_clock::now();
+
+    parcel_log_reader::record r;
+
+    while (log.next(r))
+    {
+        if (original_speed)
+            std::this_thread::sleep_until(start + r.timestamp);
+
+        parcel* p = new parcel();
+        p->header = r.header;
+        p->payload.assign(r.payload, r.payload + r.header.payload_size);
+
+        queue_parcel(p);
+        ++count;
+    }
+
+    return count;
+}
+
+template <
+    typename Transport
+  , typename Serializer
+  , template <typename> class Queue
+    >
+void basic_runtime<Transport, Serializer, Queue>::forward_parcel(
+    parcel_header header
+  , std::shared_ptr<std::vector<char> > payload
+    )
+{
+    std::shared_ptr<connection_type> conn = get_next_hop(header.destination);
+
+    // Nowhere to send it, or it has been passed on so often that it must
+    // be going around a cycle of routes; drop the parcel.
+    if (!conn || header.hops_left == 0)
+    {
+        ++parcels_dropped_;
+        return;
+    }
+
+    --header.hops_left;
+    header.flags |= parcel_header::forwarded;
+
+    conn->async_write_parcel(header, payload
+                           , std::function<void(error_code const&)>());
+}
+
+template <
+    typename Transport
+  , typename Serializer
+  , template <typename> class Queue
+    >
+void basic_runtime<Transport, Serializer, Queue>::exec_loop()
+{
+    while (!stop_flag_.load())
+    {
+        bool idle = true;
+
+        ///////////////////////////////////////////////////////////////////////
+        // First, we resume suspended tasks which have become ready again.
+        task* ready = 0;
+
+        if (ready_queue_.pop(ready))
+        {
+            BOOST_ASSERT(ready);
+
+            idle = false;
+            run_task(ready);
+        }
+
+        ///////////////////////////////////////////////////////////////////////
+        // Then, we look for pending actions to execute.
+        function_type* act_ptr = 0;
+
+        if (local_queue_.pop(act_ptr))
+        {
+            BOOST_ASSERT(act_ptr);
+
+            boost::scoped_ptr<function_type> act(act_ptr);
+
+            idle = false;
+            spawn(boost::bind(*act, boost::ref(*this)));
+        }
+
+        ///////////////////////////////////////////////////////////////////////
+        // If we can't find any work, we try to find a parcel to deserialize
+        // and execute.
+        parcel* raw_msg_ptr = 0;
+
+        if (pop_parcel(raw_msg_ptr))
+        {
+            BOOST_ASSERT(raw_msg_ptr);
+
+            boost::scoped_ptr<parcel> raw_msg(raw_msg_ptr);
+            std::shared_ptr<action_type> act(
+                Serializer::template deserialize<action_type>(*raw_msg));
+
+            // We can't execute compact parcels for actions we don't know.
+            // Say so the first time, as it means that we and a neighbour
+            // disagree about the registered actions.
+            if (!act)
+            {
+                ++parcels_dropped_;
+
+                if (!reported_unknown_action_)
+                    std::cerr << "locality " << locality_id_
+                              << ": dropping compact parcels for unknown "
+                                 "action id " << raw_msg->header.action_id
+                              << "\n";
+
+                reported_unknown_action_ = true;
+                continue;
+            }
+
+            spawn(
+                [this, act]()
+                {
+                    (*act)(*this);
+                });
+        }
+
+        ///////////////////////////////////////////////////////////////////////
+        // If there's nothing at all to do here, we look for work elsewhere.
+        else if (idle && load_balancing_)
+            request_steal();
+    }
+}
+
+template <
+    typename Transport
+  , typename Serializer
+  , template <typename> class Queue
+    >
+void basic_runtime<Transport, Serializer, Queue>::queue_parcel(parcel* p)
+{
+    BOOST_ASSERT(p);
+
+    // Count the parcel before it can be popped, so the counts never wrap.
+    ++queued_parcels_;
+
+    // A parcel that was moved once stays where it lands. Without load
+    // balancing, nothing is moved, so all parcels share one queue and are
+    // executed in the order they arrived.
+    if (   load_balancing_
+        && (p->header.flags & parcel_header::migratable)
+        && !(p->header.flags & parcel_header::migrated))
+    {
+        ++queued_migratable_;
+        migratable_queue_.push(p);
+    }
+
+    else
+        parcel_queue_.push(p);
+}
+
+template <
+    typename Transport
+  , typename Serializer
+  , template <typename> class Queue
+    >
+bool basic_runtime<Transport, Serializer, Queue>::pop_parcel(parcel*& p)
+{
+    // Parcels that can only be executed here go first, leaving the
+    // migratable ones to whoever gets to them first. But once we've taken
+    // max_pinned_streak of those in a row, a migratable one is due.
+    bool const migratable_due = pinned_streak_ >= max_pinned_streak;
+
+    if (!migratable_due && parcel_queue_.pop(p))
+    {
+        --queued_parcels_;
+        ++pinned_streak_;
+        return true;
+    }
+
+    if (migratable_queue_.pop(p))
+    {
+        --queued_migratable_;
+        --queued_parcels_;
+        pinned_streak_ = 0;
+        return true;
+    }
+
+    if (migratable_due && parcel_queue_.pop(p))
+    {
+        --queued_parcels_;
+        return true;
+    }
+
+    return false;
+}
+
+template <
+    typename Transport
+  , typename Serializer
+  , template <typename> class Queue
+    >
+void basic_runtime<Transport, Serializer, Queue>::send_control(
+    boost::uint64_t locality
+  , parcel_header::flag_type type
+  , boost::uint64_t value
+    )
+{
+    std::shared_ptr<connection_type> conn;
+
+    {
+        std::lock_guard<std::mutex> l(connections_mtx_);
+
+        typename connection_map::iterator it = connections_.find(locality);
+
+        if (it == connections_.end())
+            return;
+
+        conn = it->second;
+    }
+
+    control_message::buffer_type buf;
+    control_message(locality_id_, value).encode(buf);
+
+    parcel_header header;
+    header.destination = locality;
+    header.flags = type;
+    header.priority = parcel_header::high_priority;
+    header.payload_size = control_message::size;
+
+    std::shared_ptr<std::vector<char> >
+        payload(new std::vector<char>(buf.begin(), buf.end()));
+
+    // We're on an I/O thread, while the execution thread may be writing to
+    // the same connection; async_write_parcel queues behind its writes.
+    conn->async_write_parcel(header, payload
+                           , std::function<void(error_code const&)>());
+}
+
+template <
+    typename Transport
+  , typename Serializer
+  , template <typename> class Queue
+    >
+void basic_runtime<Transport, Serializer, Queue>::receive_control(
+    parcel const& p
+    )
+{
+    if (p.payload.size() != control_message::size)
+        return;
+
+    control_message::buffer_type buf;
+    std::copy(p.payload.begin(), p.payload.end(), buf.begin());
+
+    control_message msg;
+    msg.decode(buf);
+
+    if (p.header.flags & parcel_header::load_report)
+    {
+        std::lock_guard<std::mutex> l(loads_mtx_);
+        neighbour_loads_[msg.locality] = msg.value;
+    }
+
+    else if (p.header.flags & parcel_header::steal_request)
+    {
+        // Whoever asks for work has none.
+        {
+            std::lock_guard<std::mutex> l(loads_mtx_);
+            neighbour_loads_[msg.locality] = 0;
+        }
+
+        handle_steal_request(msg.locality, msg.value);
+    }
+}
+
+template <
+    typename Transport
+  , typename Serializer
+  , template <typename> class Queue
+    >
+void basic_runtime<Transport, Serializer, Queue>::report_load(
+    error_code const& error
+    )
+{
+    if (error || stop_flag_.load())
+        return;
+
+    boost::uint64_t load = queued_parcels_.load();
+
+    if (last_reported_load_.exchange(load) != load)
+    {
+        for (typename connection_map::value_type const& c : get_connections())
+            send_control(c.first, parcel_header::load_report, load);
+    }
+
+    load_timer_.expires_from_now(balancing_.report_interval);
+    load_timer_.async_wait(boost::bind(&basic_runtime::report_load
+                                     , boost::ref(*this)
+                                     , asio::placeholders::error));
+}
+
+template <
+    typename Transport
+  , typename Serializer
+  , template <typename> class Queue
+    >
+bool basic_runtime<Transport, Serializer, Queue>::redirect_parcel(parcel* p)
+{
+    if (  !load_balancing_
+       || !(p->header.flags & parcel_header::migratable)
+       ||  (p->header.flags & parcel_header::migrated))
+        return false;
+
+    boost::uint64_t load = queued_parcels_.load();
+
+    if (load < balancing_.redirect_threshold)
+        return false;
+
+    boost::uint64_t target = 0;
+
+    {
+        std::lock_guard<std::mutex> l(loads_mtx_);
+
+        load_map::iterator best = neighbour_loads_.end();
+
+        for (load_map::iterator it = neighbour_loads_.begin();
+             it != neighbour_loads_.end(); ++it)
+            if (best == neighbour_loads_.end() || it->second < best->second)
+                best = it;
+
+        // Reports lag behind, and while everyone's queues are growing, the
+        // neighbours always look less loaded than they are. To avoid
+        // trading parcels back and forth, we only redirect while we have
+        // more than twice as many.
+        if (  best == neighbour_loads_.end()
+           || 2 * best->second + balancing_.redirect_threshold > load)
+            return false;
+
+        // Until it tells us otherwise, assume the target queued the parcel,
+        // so that we don't send all of our excess to one neighbour.
+        ++best->second;
+        target = best->first;
+    }
+
+    std::shared_ptr<connection_type> conn;
+
+    {
+        std::lock_guard<std::mutex> l(connections_mtx_);
+
+        typename connection_map::iterator it = connections_.find(target);
+
+        if (it == connections_.end())
+            return false;
+
+        conn = it->second;
+    }
+
+    return migrate_parcel(p, conn);
+}
+
+template <
+    typename Transport
+  , typename Serializer
+  , template <typename> class Queue
+    >
+void basic_runtime<Transport, Serializer, Queue>::request_steal()
+{
+    std::chrono::steady_clock::time_point now
+        = std::chrono::steady_clock::now();
+
+    if (now < steal_deadline_)
+        return;
+
+    // If nobody answers, we ask again once fresh load reports are in.
+    steal_deadline_ = now + 2 * balancing_.report_interval;
+
+    boost::uint64_t victim = 0;
+    boost::uint64_t load = 0;
+
+    {
+        std::lock_guard<std::mutex> l(loads_mtx_);
+
+        for (load_map::value_type const& n : neighbour_loads_)
+            if (n.second > load)
+            {
+                victim = n.first;
+                load = n.second;
+            }
+    }
+
+    if (load < balancing_.steal_threshold)
+        return;
+
+    boost::uint64_t count = std::min(balancing_.steal_batch, load / 2);
+
+    // Control parcels are only sent by the I/O thread.
+    io_service_.post(boost::bind(&basic_runtime::send_control
+                               , boost::ref(*this)
+                               , victim
+                               , parcel_header::steal_request
+                               , std::max<boost::uint64_t>(1, count)));
+}
+
+template <
+    typename Transport
+  , typename Serializer
+  , template <typename> class Queue
+    >
+void basic_runtime<Transport, Serializer, Queue>::handle_steal_request(
+    boost::uint64_t thief
+  , boost::uint64_t count
+    )
+{
+    if (!load_balancing_)
+        return;
+
+    std::shared_ptr<connection_type> conn;
+
+    {
+        std::lock_guard<std::mutex> l(connections_mtx_);
+
+        typename connection_map::iterator it = connections_.find(thief);
+
+        if (it == connections_.end())
+            return;
+
+        conn = it->second;
+    }
+
+    // Keep at least half of our migratable parcels.
+    count = std::min(count, queued_migratable_.load() / 2);
+
+    for (boost::uint64_t i = 0; i < count; ++i)
+    {
+        parcel* p = 0;
+
+        if (!migratable_queue_.pop(p))
+            break;
+
+        --queued_migratable_;
+        --queued_parcels_;
+
+        if (!migrate_parcel(p, conn))
+        {
+            // The thief can't read it; put it back, and stop trying.
+            queue_parcel(p);
+            break;
+        }
+    }
+}
+
+template <
+    typename Transport
+  , typename Serializer
+  , template <typename> class Queue
+    >
+bool basic_runtime<Transport, Serializer, Queue>::migrate_parcel(
+    parcel* p
+  , std::shared_ptr<connection_type> const& conn
+    )
+{
+    BOOST_ASSERT(p && conn);
+
+    // A compact parcel can only go to neighbours that read compact parcels
+    // from us, i.e. that share our archive version and data layout.
+    if ((p->header.flags & parcel_header::compact) && !conn->is_compact())
+        return false;
+
+    boost::scoped_ptr<parcel> moved(p);
+
+    parcel_header header = moved->header;
+    header.destination = conn->get_locality();
+    header.flags |= parcel_header::migrated;
+
+    std::shared_ptr<std::vector<char> > payload(new std::vector<char>());
+    payload->swap(moved->payload);
+
+    ++parcels_migrated_;
+
+    conn->async_write_parcel(header, payload
+                           , std::function<void(error_code const&)>());
+
+    return true;
+}
+
+template <
+    typename Transport
+  , typename Serializer
+  , template <typename> class Queue
+    >
+void basic_runtime<Transport, Serializer, Queue>::spawn(task::function_type f)
+{
+    task* t = 0;
+
+    if (!free_tasks_.empty())
+    {
+        t = free_tasks_.back();
+        free_tasks_.pop_back();
+    }
+
+    else
+    {
+        tasks_.emplace_back(new task(*this, stack_size_));
+        t = tasks_.back().get();
+    }
+
+    t->reset(std::move(f));
+
+    run_task(t);
+}
+
+template <
+    typename Transport
+  , typename Serializer
+  , template <typename> class Queue
+    >
+void basic_runtime<Transport, Serializer, Queue>::run_task(task* t)
+{
+    BOOST_ASSERT(t && !t->finished());
+    BOOST_ASSERT(!suspend_hook_);
+
+    t->resume();
+
+    if (t->finished())
+    {
+        free_tasks_.push_back(t);
+        return;
+    }
+
+    // The task suspended itself. If it left a hook, that hook decides when
+    // the task is resumed; otherwise, it just yielded.
+    if (suspend_hook_)
+    {
+        std::function<void(task*)> hook;
+        std::swap(hook, suspend_hook_);
+        hook(t);
+    }
+
+    else
+        resume(t);
+}
+
+template <
+    typename Transport
+  , typename Serializer
+  , template <typename> class Queue
+    >
+void basic_runtime<Transport, Serializer, Queue>::suspend(
+    std::function<void(task*)> hook
+    )
+{
+    task* t = task::current();
+    BOOST_ASSERT(t && (&t->get_scheduler() == this));
+
+    suspend_hook_ = hook;
+    t->suspend();
+}
+
+template <
+    typename Transport
+  , typename Serializer
+  , template <typename> class Queue
+    >
+void basic_runtime<Transport, Serializer, Queue>::yield()
+{
+    suspend(std::function<void(task*)>());
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// basic_connection
+
+template <typename Runtime>
+void basic_connection<Runtime>::async_write(
+    action_type const& act
+  , std::function<void(error_code const&)> handler
+    )
+{
+    // Every connection of a runtime is of its transport's connection type.
+    typedef typename Runtime::connection_type connection_type;
+
+    runtime_.post_write(
+        std::static_pointer_cast<connection_type>(this->shared_from_this())
+      , peer_locality_, act, handler);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// basic_tcp_connection
+
+template <typename Runtime>
+basic_tcp_connection<Runtime>::~basic_tcp_connection()
+{
+    // Ensure a graceful shutdown.
+    if (socket_.is_open())
+    {
+        error_code ec;
+        socket_.shutdown(asio_tcp::socket::shutdown_both, ec);
+        socket_.close(ec);
+    }
+
+    delete in_parcel_;
+}
+
+template <typename Runtime>
+void basic_tcp_connection<Runtime>::write_hello()
+{
+    handshake h;
+    h.locality = runtime_.get_locality_id();
+    h.archive_version = boost::archive::BOOST_ARCHIVE_VERSION();
+    h.native_format = handshake::local_native_format();
+
+    if (runtime_.get_compact_parcels())
+        h.capabilities |= handshake::compact_parcels;
+
+    handshake::buffer_type buf;
+    h.encode(buf);
+
+    asio::write(socket_, asio::buffer(buf));
+}
+
+template <typename Runtime>
+void basic_tcp_connection<Runtime>::read_hello()
+{
+    handshake::buffer_type buf;
+    asio::read(socket_, asio::buffer(buf));
+    negotiate(buf);
+}
+
+template <typename Runtime>
+void basic_tcp_connection<Runtime>::async_read_hello()
+{
+    std::shared_ptr<handshake::buffer_type> buf(new handshake::buffer_type());
+
+    asio::async_read(socket_,
+        asio::buffer(*buf),
+            boost::bind(&basic_tcp_connection::handle_read_hello
+                      , shared_this()
+                      , asio::placeholders::error
+                      , buf));
+}
+
+template <typename Runtime>
+void basic_tcp_connection<Runtime>::handle_read_hello(
+    error_code const& error
+  , std::shared_ptr<handshake::buffer_type> buf
+    )
+{
+    if (error) return;
+
+    negotiate(*buf);
+
+    runtime_.add_locality(shared_this());
+    runtime_.check_main();
+
+    // Start reading parcels.
+    async_read();
+}
+
+template <typename Runtime>
+void basic_tcp_connection<Runtime>::negotiate(
+    handshake::buffer_type const& buf
+    )
+{
+    handshake h;
+    h.decode(buf);
+
+    peer_locality_ = h.locality;
+
+    // Compact parcels leave out the archive header, so both ends have to be
+    // using the same archive version and native data layout.
+    compact_ = runtime_.get_compact_parcels()
+            && (h.capabilities & handshake::compact_parcels)
+            && (h.archive_version == boost::archive::BOOST_ARCHIVE_VERSION())
+            && (h.native_format == handshake::local_native_format());
+}
+
+template <typename Runtime>
+void basic_tcp_connection<Runtime>::async_read()
+{
+    BOOST_ASSERT(in_parcel_ == 0);
+    in_parcel_ = new parcel();
+
+    asio::async_read(socket_,
+        asio::buffer(in_header_buffer_),
+            boost::bind(&basic_tcp_connection::handle_read_header
+                      , shared_this()
+                      , asio::placeholders::error));
+}
+
+template <typename Runtime>
+void basic_tcp_connection<Runtime>::handle_read_header(
+    error_code const& error
+    )
+{
+    if (error) return;
+
+    BOOST_ASSERT(in_parcel_);
+
+    in_parcel_->header.decode(in_header_buffer_);
+
+    // We can't make sense of parcels from a newer version of the protocol,
+    // and once we lose track of where parcels start, nothing else on this
+    // connection can be trusted either.
+    if (in_parcel_->header.version != parcel_header::current_version)
+    {
+        close("unsupported parcel version");
+        return;
+    }
+
+    if (in_parcel_->header.payload_size > parcel_header::max_payload_size)
+    {
+        close("parcel payload too large");
+        return;
+    }
+
+    in_parcel_->payload.resize(in_parcel_->header.payload_size);
+
+    asio::async_read(socket_,
+        asio::buffer(in_parcel_->payload),
+            boost::bind(&basic_tcp_connection::handle_read_data
+                      , shared_this()
+                      , asio::placeholders::error));
+}
+
+template <typename Runtime>
+void basic_tcp_connection<Runtime>::handle_read_data(error_code const& error)
+{
+    if (error) return;
+
+    parcel* raw_msg = 0;
+    std::swap(in_parcel_, raw_msg);
+
+    runtime_.record_parcel(peer_locality_, *raw_msg);
+    runtime_.deliver_parcel(raw_msg);
+
+    // Start the next read.
+    async_read();
+}
+
+template <typename Runtime>
+void basic_tcp_connection<Runtime>::async_write_parcel(
+    parcel_header const& header
+  , std::shared_ptr<std::vector<char> > payload
+  , std::function<void(error_code const&)> handler
+    )
+{
+    BOOST_ASSERT(header.payload_size == payload->size());
+
+    outgoing_parcel out;
+    out.header.reset(new parcel_header::buffer_type());
+    out.payload = payload;
+    out.handler = handler;
+
+    header.encode(*out.header);
+
+    strand_.post(boost::bind(&basic_tcp_connection::queue_write
+                           , shared_this(), out));
+}
+
+template <typename Runtime>
+void basic_tcp_connection<Runtime>::queue_write(outgoing_parcel const& out)
+{
+    out_queue_.push_back(out);
+
+    if (out_in_flight_ == 0)
+        start_write();
+}
+
+template <typename Runtime>
+void basic_tcp_connection<Runtime>::start_write()
+{
+    BOOST_ASSERT(out_in_flight_ == 0 && !out_queue_.empty());
+
+    out_in_flight_ = out_queue_.size();
+    if (out_in_flight_ > max_gathered_parcels)
+        out_in_flight_ = max_gathered_parcels;
+
+    // Gather everything that's queued (up to a limit) into one write.
+    std::vector<boost::asio::const_buffer> buffers;
+
+    for (std::size_t i = 0; i < out_in_flight_; ++i)
+    {
+        buffers.push_back(boost::asio::buffer(*out_queue_[i].header));
+        buffers.push_back(boost::asio::buffer(*out_queue_[i].payload));
+    }
+
+    boost::asio::async_write(socket_, buffers,
+        strand_.wrap(boost::bind(&basic_tcp_connection::handle_write
+                               , shared_this()
+                               , boost::asio::placeholders::error)));
+}
+
+template <typename Runtime>
+void basic_tcp_connection<Runtime>::handle_write(error_code const& error)
+{
+    // After an error, nothing else can be written either.
+    std::size_t done = error ? out_queue_.size() : out_in_flight_;
+
+    std::vector<std::function<void(error_code const&)> > handlers;
+
+    for (std::size_t i = 0; i < done; ++i)
+    {
+        if (out_queue_.front().handler)
+            handlers.push_back(out_queue_.front().handler);
+        out_queue_.pop_front();
+    }
+
+    out_in_flight_ = 0;
+
+    if (!out_queue_.empty())
+        start_write();
+
+    for (std::function<void(error_code const&)> const& h : handlers)
+        h(error);
+}
+
+template <typename Runtime>
+void basic_tcp_connection<Runtime>::close(char const* reason)
+{
+    std::cerr << "locality " << runtime_.get_locality_id()
+              << ": closing connection to locality " << peer_locality_
+              << ": " << reason << "\n";
+
+    error_code ec;
+    socket_.shutdown(asio_tcp::socket::shutdown_both, ec);
+    socket_.close(ec);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// basic_loopback_connection
+
+template <typename Runtime>
+void basic_loopback_connection<Runtime>::async_write_parcel(
+    parcel_header const& header
+  , std::shared_ptr<std::vector<char> > payload
+  , std::function<void(error_code const&)> handler
+    )
+{
+    BOOST_ASSERT(header.payload_size == payload->size());
+
+    std::shared_ptr<basic_loopback_connection> peer = peer_.lock();
+
+    error_code ec;
+
+    if (peer)
+    {
+        parcel* p = new parcel();
+        p->header = header;
+        p->payload = *payload;
+
+        peer->runtime_.record_parcel(peer->peer_locality_, *p);
+        peer->runtime_.deliver_parcel(p);
+    }
+    else
+        ec = asio::error::not_connected;
+
+    // Like the TCP transport, never call the handler from inside the write.
+    if (handler)
+        runtime_.get_io_service().post(boost::bind(handler, ec));
+}
+
+#endif
+
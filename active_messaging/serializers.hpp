@@ -0,0 +1,215 @@
+// Copyright (c) 2012-2013 Bryce Adelstein-Lelbach
+// Copyright (c) 2012-2013 Hartmut Kaiser
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+#if !defined(CPPNOW_D5898083_1397_4623_AE2D_9FD23E0A839F)
+#define CPPNOW_D5898083_1397_4623_AE2D_9FD23E0A839F
+
+// Serializer policies for basic_runtime. A serializer policy is a class with
+//
+//     // Serializes act into a new buffer. A compact parcel contains just the
+//     // body of the action, which must have been registered.
+//     template <typename Action>
+//     static std::vector<char>* serialize(Action const& act, bool compact);
+//
+//     // Deserializes a parcel. Returns 0 if the parcel is compact, but its
+//     // action is not registered here.
+//     template <typename Action>
+//     static Action* deserialize(parcel& p);
+//
+// where Action is the action base of the runtime. Both serializers below
+// write Boost binary archives, and produce the same bytes, so runtimes using
+// either can talk to each other.
+
+#include <streambuf>
+#include <vector>
+
+#include <boost/assert.hpp>
+#include <boost/iostreams/stream.hpp>
+#include <boost/archive/binary_oarchive.hpp>
+#include <boost/archive/binary_iarchive.hpp>
+
+#include "parcel.hpp"
+#include "action_registry.hpp"
+#include "container_device.hpp"
+
+/// Boost binary archives on top of an iostream over the parcel buffer.
+struct iostream_serializer
+{
+    template <typename Action>
+    static std::vector<char>* serialize(Action const& act, bool compact)
+    {
+        std::vector<char>* raw_msg_ptr = new std::vector<char>();
+
+        typedef container_device<std::vector<char> > io_device_type;
+        boost::iostreams::stream<io_device_type> io(*raw_msg_ptr);
+
+        if (compact)
+        {
+            basic_action_serializer<Action> const* s
+                = get_action_serializer<Action>(get_action_id(act));
+            BOOST_ASSERT(s);
+
+            boost::archive::binary_oarchive
+                archive(io, boost::archive::no_header);
+            s->save(archive, act);
+        }
+
+        else
+        {
+            Action const* act_ptr = &act;
+
+            boost::archive::binary_oarchive archive(io);
+            archive & act_ptr;
+        }
+
+        return raw_msg_ptr;
+    }
+
+    template <typename Action>
+    static Action* deserialize(parcel& p)
+    {
+        typedef container_device<std::vector<char> > io_device_type;
+        boost::iostreams::stream<io_device_type> io(p.payload);
+
+        Action* act_ptr = 0;
+
+        if (p.header.flags & parcel_header::compact)
+        {
+            basic_action_serializer<Action> const* s
+                = get_action_serializer<Action>(p.header.action_id);
+
+            if (!s)
+                return 0;
+
+            boost::archive::binary_iarchive
+                archive(io, boost::archive::no_header);
+            act_ptr = s->load(archive);
+        }
+
+        else
+        {
+            boost::archive::binary_iarchive archive(io);
+            archive & act_ptr;
+        }
+
+        BOOST_ASSERT(act_ptr);
+
+        return act_ptr;
+    }
+};
+
+namespace detail
+{
+
+/// A write-only streambuf which appends to a vector.
+struct vector_sink_buf : std::streambuf
+{
+  private:
+    std::vector<char>& v_;
+
+  public:
+    explicit vector_sink_buf(std::vector<char>& v)
+      : v_(v)
+    {}
+
+  protected:
+    std::streamsize xsputn(char const* s, std::streamsize n)
+    {
+        v_.insert(v_.end(), s, s + n);
+        return n;
+    }
+
+    int_type overflow(int_type c)
+    {
+        if (!traits_type::eq_int_type(c, traits_type::eof()))
+            v_.push_back(traits_type::to_char_type(c));
+        return traits_type::not_eof(c);
+    }
+};
+
+/// A read-only streambuf over a vector, which it reads in place.
+struct vector_source_buf : std::streambuf
+{
+    explicit vector_source_buf(std::vector<char>& v)
+    {
+        char* p = v.data();
+        setg(p, p, p + v.size());
+    }
+};
+
+}
+
+/// Boost binary archives attached directly to a streambuf over the parcel
+/// buffer, skipping the iostream layer, and without the codecvt facet the
+/// archives otherwise imbue (binary archives never use it). Writes the same
+/// bytes as iostream_serializer, in about two thirds of the time.
+struct streambuf_serializer
+{
+    template <typename Action>
+    static std::vector<char>* serialize(Action const& act, bool compact)
+    {
+        std::vector<char>* raw_msg_ptr = new std::vector<char>();
+
+        detail::vector_sink_buf buf(*raw_msg_ptr);
+
+        if (compact)
+        {
+            basic_action_serializer<Action> const* s
+                = get_action_serializer<Action>(get_action_id(act));
+            BOOST_ASSERT(s);
+
+            boost::archive::binary_oarchive archive(buf
+              , boost::archive::no_header | boost::archive::no_codecvt);
+            s->save(archive, act);
+        }
+
+        else
+        {
+            Action const* act_ptr = &act;
+
+            boost::archive::binary_oarchive
+                archive(buf, boost::archive::no_codecvt);
+            archive & act_ptr;
+        }
+
+        return raw_msg_ptr;
+    }
+
+    template <typename Action>
+    static Action* deserialize(parcel& p)
+    {
+        detail::vector_source_buf buf(p.payload);
+
+        Action* act_ptr = 0;
+
+        if (p.header.flags & parcel_header::compact)
+        {
+            basic_action_serializer<Action> const* s
+                = get_action_serializer<Action>(p.header.action_id);
+
+            if (!s)
+                return 0;
+
+            boost::archive::binary_iarchive archive(buf
+              , boost::archive::no_header | boost::archive::no_codecvt);
+            act_ptr = s->load(archive);
+        }
+
+        else
+        {
+            boost::archive::binary_iarchive
+                archive(buf, boost::archive::no_codecvt);
+            archive & act_ptr;
+        }
+
+        BOOST_ASSERT(act_ptr);
+
+        return act_ptr;
+    }
+};
+
+#endif
+
@@ -0,0 +1,210 @@
+// Copyright (c) 2012-2013 Bryce Adelstein-Lelbach
+// Copyright (c) 2012-2013 Hartmut Kaiser
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+#if !defined(CPPNOW_81EAD93F_EED5_4704_B328_20D6ECCA64FC)
+#define CPPNOW_81EAD93F_EED5_4704_B328_20D6ECCA64FC
+
+#include <ucontext.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include <cstdint>
+#include <functional>
+#include <new>
+#include <utility>
+
+#include <boost/assert.hpp>
+
+struct task;
+
+/// What a task needs from whatever runs it. Implemented by basic_runtime,
+/// so that tasks (and the futures they wait on) don't depend on the policies
+/// a runtime was instantiated with.
+struct scheduler
+{
+    virtual ~scheduler() {}
+
+    /// Suspend the calling task; once it is off of its stack, call hook
+    /// with it.
+    virtual void suspend(std::function<void(task*)> hook) = 0;
+
+    /// Make a suspended task ready to run again. Can be called from any
+    /// thread.
+    virtual void resume(task* t) = 0;
+};
+
+/// The stack of a task: memory mapped, with an inaccessible guard page below
+/// it (stacks grow down), so that overflowing it faults instead of silently
+/// corrupting whatever happens to lie next to it.
+struct task_stack
+{
+  private:
+    char* base_;
+    std::size_t mapped_size_;
+    std::size_t page_size_;
+
+    task_stack(task_stack const&);
+    task_stack& operator=(task_stack const&);
+
+  public:
+    /// Throws std::bad_alloc if the stack can't be mapped.
+    explicit task_stack(std::size_t size)
+      : base_(0)
+      , mapped_size_(0)
+      , page_size_(std::size_t(sysconf(_SC_PAGESIZE)))
+    {
+        // Round up to whole pages, and add the guard page.
+        mapped_size_ = (size + page_size_ - 1) / page_size_ * page_size_
+                     + page_size_;
+
+        void* p = mmap(0, mapped_size_, PROT_READ | PROT_WRITE
+                     , MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+        if (p == MAP_FAILED)
+            throw std::bad_alloc();
+
+        base_ = static_cast<char*>(p);
+
+        if (mprotect(base_, page_size_, PROT_NONE) != 0)
+        {
+            munmap(base_, mapped_size_);
+            throw std::bad_alloc();
+        }
+    }
+
+    ~task_stack()
+    {
+        munmap(base_, mapped_size_);
+    }
+
+    /// The usable part of the stack, above the guard page.
+    char* data() const
+    {
+        return base_ + page_size_;
+    }
+
+    std::size_t size() const
+    {
+        return mapped_size_ - page_size_;
+    }
+};
+
+/// A lightweight, stackful user-level task. Tasks are scheduled cooperatively
+/// by the execution thread of a runtime: a task runs until it either finishes
+/// or suspends itself (e.g. to wait on a future), at which point control
+/// returns to whoever resumed it. Finished tasks can be reset and reused, so
+/// their stacks are only allocated once.
+struct task
+{
+    typedef std::function<void()> function_type;
+
+  private:
+    scheduler& scheduler_;
+
+    ucontext_t context_;
+    ucontext_t* caller_;
+
+    task_stack stack_;
+
+    function_type f_;
+
+    bool finished_;
+
+  public:
+    task(scheduler& s, std::size_t stack_size)
+      : scheduler_(s)
+      , context_()
+      , caller_(0)
+      , stack_(stack_size)
+      , f_()
+      , finished_(true)
+    {}
+
+    scheduler& get_scheduler()
+    {
+        return scheduler_;
+    }
+
+    bool finished() const
+    {
+        return finished_;
+    }
+
+    /// Prepare a finished task to run f the next time it is resumed.
+    void reset(function_type f)
+    {
+        BOOST_ASSERT(finished_);
+
+        f_ = std::move(f);
+        finished_ = false;
+
+        getcontext(&context_);
+        context_.uc_stack.ss_sp = stack_.data();
+        context_.uc_stack.ss_size = stack_.size();
+        context_.uc_link = 0;
+
+        // makecontext only passes int arguments, so we smuggle our this
+        // pointer through as two halves. Shifting twice by 16 keeps this
+        // defined where pointers are only 32 bits wide (hi is 0 there).
+        std::uintptr_t p = reinterpret_cast<std::uintptr_t>(this);
+        makecontext(&context_, reinterpret_cast<void(*)()>(&task::trampoline)
+                  , 2
+                  , static_cast<unsigned>((p >> 16) >> 16)
+                  , static_cast<unsigned>(p & 0xFFFFFFFF));
+    }
+
+    /// Switch to this task. Returns when the task finishes or suspends.
+    void resume()
+    {
+        BOOST_ASSERT(!finished_);
+
+        task* prev = current();
+        current() = this;
+
+        ucontext_t caller;
+        caller_ = &caller;
+        swapcontext(&caller, &context_);
+
+        current() = prev;
+    }
+
+    /// Switch back to whoever resumed this task. Must be called from inside
+    /// the task.
+    void suspend()
+    {
+        BOOST_ASSERT(current() == this);
+        swapcontext(&context_, caller_);
+    }
+
+    /// The task running on this OS thread, or 0 if we are not in a task.
+    static task*& current()
+    {
+        static thread_local task* t = 0;
+        return t;
+    }
+
+  private:
+    static void trampoline(unsigned hi, unsigned lo)
+    {
+        std::uintptr_t p = ((static_cast<std::uintptr_t>(hi) << 16) << 16)
+                         | static_cast<std::uintptr_t>(lo);
+        task* self = reinterpret_cast<task*>(p);
+
+        {
+            // Destroy the function (and anything it captured) before we
+            // leave the task's stack for the last time.
+            function_type f;
+            std::swap(f, self->f_);
+            f();
+        }
+
+        self->finished_ = true;
+        self->suspend();
+    }
+};
+
+#endif
+
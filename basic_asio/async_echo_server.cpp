@@ -4,52 +4,377 @@
 // Distributed under the Boost Software License, Version 1.0. (See accompanying
 // file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
 
+// An echo server which serves any number of clients at once. Connections are
+// accepted asynchronously, each one is owned by a session object with its own
+// buffers, and the io_service is run by a pool of threads.
+
+#include <algorithm>
+#include <chrono>
 #include <iostream>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include <boost/bind.hpp>
 #include <boost/asio.hpp>
+#include <boost/program_options.hpp>
 
 using boost::system::error_code;
 namespace asio = boost::asio;
+namespace po = boost::program_options;
 typedef boost::asio::ip::tcp asio_tcp;
 
-int main()
+///////////////////////////////////////////////////////////////////////////////
+/// One client connection. Reading and echoing are pipelined: the session
+/// keeps reading while an echo is being written, and everything read in the
+/// meantime is echoed by the next write, gathered into a single writev.
+///
+/// Data is read into chunks whose size adapts to the traffic: a read which
+/// fills its chunk doubles the size of the next one (up to max_read_size),
+/// and one which uses less than a quarter of it halves it. When a read
+/// fills its chunk, the session goes on to drain whatever else the kernel
+/// already has for it with non-blocking reads, instead of going back to the
+/// reactor for every chunk.
+///
+/// At most max_buffered bytes are held for a client; beyond that the session
+/// stops reading until the echo catches up, which pushes back on the client.
+///
+/// Reads, writes and their handlers can overlap, and the io_service is run
+/// on several threads, so all handlers of a session go through its strand.
+struct session : std::enable_shared_from_this<session>
 {
-    try
+  private:
+    static std::size_t const min_read_size = 1024;
+    static std::size_t const max_read_size = 256 * 1024;
+    static std::size_t const max_buffered = 4 * 1024 * 1024;
+    static std::size_t const max_free_chunks = 16;
+
+    struct chunk
     {
-        asio::io_service io_service;
+        std::vector<char> data;
+        std::size_t size;
+    };
+
+    asio_tcp::socket socket_;
+    asio::io_service::strand strand_;
+    bool verbose_;
+
+    std::size_t read_size_;
+    chunk reading_;
+    std::vector<chunk> pending_;
+    std::vector<chunk> writing_;
+    std::vector<chunk> free_chunks_;
+    std::size_t buffered_;
+    bool read_paused_;
+
+  public:
+    session(asio::io_service& io_service, bool verbose)
+      : socket_(io_service)
+      , strand_(io_service)
+      , verbose_(verbose)
+      , read_size_(4 * 1024)
+      , buffered_(0)
+      , read_paused_(false)
+    {}
+
+    asio_tcp::socket& get_socket()
+    {
+        return socket_;
+    }
+
+    void start()
+    {
+        socket_.set_option(asio_tcp::no_delay(true));
+
+        // Only affects our synchronous reads; asio's own async operations
+        // don't care.
+        socket_.non_blocking(true);
+
+        async_read();
+    }
+
+  private:
+    chunk get_chunk()
+    {
+        chunk c;
+
+        if (!free_chunks_.empty())
+        {
+            c = std::move(free_chunks_.back());
+            free_chunks_.pop_back();
+        }
+
+        if (c.data.size() != read_size_)
+            c.data.resize(read_size_);
+
+        c.size = 0;
+        return c;
+    }
+
+    void put_chunk(chunk& c)
+    {
+        if (free_chunks_.size() < max_free_chunks)
+            free_chunks_.push_back(std::move(c));
+    }
+
+    /// Adapts read_size_ to how much of a chunk the last read used.
+    void adapt(std::size_t bytes, std::size_t capacity)
+    {
+        if (bytes == capacity && read_size_ < max_read_size)
+            read_size_ *= 2;
+        else if (bytes < capacity / 4 && read_size_ > min_read_size)
+            read_size_ /= 2;
+    }
+
+    void push_pending(chunk& c)
+    {
+        if (verbose_)
+            std::cout << std::string(c.data.data(), c.size) << "\n";
+
+        buffered_ += c.size;
+        pending_.push_back(std::move(c));
+    }
+
+    void async_read()
+    {
+        if (buffered_ >= max_buffered)
+        {
+            read_paused_ = true;
+            return;
+        }
+
+        reading_ = get_chunk();
+
+        socket_.async_read_some(asio::buffer(reading_.data), strand_.wrap(
+            boost::bind(&session::handle_read
+                      , shared_from_this()
+                      , asio::placeholders::error
+                      , asio::placeholders::bytes_transferred)));
+    }
+
+    void handle_read(error_code const& error, std::size_t bytes)
+    {
+        if (error) return;
+
+        bool full = (bytes == reading_.data.size());
+
+        reading_.size = bytes;
+        adapt(bytes, reading_.data.size());
+        push_pending(reading_);
+
+        // A read which filled its chunk probably left more data behind; drain
+        // it without going back through the reactor. (A read which didn't
+        // most likely emptied the socket, and trying again would just cost
+        // a system call returning would_block.)
+        error_code ec;
+
+        while (full && buffered_ < max_buffered)
+        {
+            chunk c = get_chunk();
+
+            c.size = socket_.read_some(asio::buffer(c.data), ec);
+
+            if (ec)
+            {
+                put_chunk(c);
+                break;
+            }
+
+            full = (c.size == c.data.size());
+
+            adapt(c.size, c.data.size());
+            push_pending(c);
+        }
+
+        async_write();
+
+        // Anything but "nothing more for now" ends the session once the
+        // echo has been written.
+        if (!ec || ec == asio::error::would_block)
+            async_read();
+    }
+
+    void async_write()
+    {
+        if (!writing_.empty() || pending_.empty())
+            return;
+
+        std::swap(writing_, pending_);
+
+        std::vector<asio::const_buffer> buffers;
+        buffers.reserve(writing_.size());
+
+        for (chunk const& c : writing_)
+            buffers.push_back(asio::buffer(c.data.data(), c.size));
 
-        asio_tcp::endpoint endpoint(asio_tcp::v4(), 2000);
-        asio_tcp::acceptor acceptor(io_service, endpoint);
+        asio::async_write(socket_, buffers, strand_.wrap(
+            boost::bind(&session::handle_write
+                      , shared_from_this()
+                      , asio::placeholders::error
+                      , asio::placeholders::bytes_transferred)));
+    }
+
+    void handle_write(error_code const& error, std::size_t bytes)
+    {
+        if (error) return;
+
+        buffered_ -= bytes;
 
-        for (;;)
+        for (chunk& c : writing_)
+            put_chunk(c);
+        writing_.clear();
+
+        async_write();
+
+        if (read_paused_)
         {
-            asio_tcp::socket socket(io_service);
-
-            error_code ec;
-            acceptor.accept(socket, ec);
-            if (ec) continue;
-
-            std::size_t const max_length = 1024;
-            char msg[max_length];
-
-            std::function<void(error_code const&, std::size_t)>
-                f = [&](error_code const& ec, std::size_t bytes)
-                    {
-                        if (ec) return;
-                        std::cout << std::string(msg, bytes) << "\n";
-                        asio::async_write(socket, asio::buffer(msg, bytes),
-                            [&](error_code const& ec, std::size_t)
-                            {
-                                if (ec) return;
-                                auto buf = asio::buffer(msg, max_length);
-                                socket.async_read_some(buf, f);
-                            });
-                    };
-
-            socket.async_read_some(asio::buffer(msg, max_length), f);
-
-            io_service.run();
+            read_paused_ = false;
+            async_read();
         }
     }
+};
+
+struct server
+{
+  private:
+    asio::io_service& io_service_;
+    asio_tcp::acceptor acceptor_;
+    bool verbose_;
+
+    /// Delays the next accept after a failed one (e.g. when we're out of
+    /// file descriptors), so that we don't spin on the error.
+    asio::steady_timer accept_timer_;
+    std::chrono::milliseconds accept_backoff_;
+
+    static std::chrono::milliseconds min_accept_backoff()
+    {
+        return std::chrono::milliseconds(10);
+    }
+
+    static std::chrono::milliseconds max_accept_backoff()
+    {
+        return std::chrono::milliseconds(1000);
+    }
+
+  public:
+    server(asio::io_service& io_service, unsigned short port, bool verbose)
+      : io_service_(io_service)
+      , acceptor_(io_service, asio_tcp::endpoint(asio_tcp::v4(), port))
+      , verbose_(verbose)
+      , accept_timer_(io_service)
+      , accept_backoff_(min_accept_backoff())
+    {
+        async_accept();
+    }
+
+  private:
+    void async_accept()
+    {
+        std::shared_ptr<session> s(new session(io_service_, verbose_));
+
+        acceptor_.async_accept(s->get_socket(),
+            boost::bind(&server::handle_accept
+                      , this
+                      , asio::placeholders::error
+                      , s));
+    }
+
+    void handle_accept(error_code const& error, std::shared_ptr<session> s)
+    {
+        if (!error)
+        {
+            s->start();
+
+            accept_backoff_ = min_accept_backoff();
+            async_accept();
+            return;
+        }
+
+        // The acceptor has been closed; we're shutting down.
+        if (error == asio::error::operation_aborted)
+            return;
+
+        std::cerr << "accept failed: " << error.message()
+                  << "; retrying in " << accept_backoff_.count() << "ms\n";
+
+        accept_timer_.expires_from_now(accept_backoff_);
+        accept_timer_.async_wait(boost::bind(&server::handle_accept_backoff
+                                           , this
+                                           , asio::placeholders::error));
+
+        accept_backoff_ = std::min(accept_backoff_ * 2, max_accept_backoff());
+    }
+
+    void handle_accept_backoff(error_code const& error)
+    {
+        if (error) return;
+
+        async_accept();
+    }
+};
+
+int main(int argc, char** argv)
+{
+    // Parse command line.
+    po::variables_map vm;
+
+    po::options_description
+        cmdline("Usage: async_echo_server [--port <port>] [--threads <n>]"
+                " [--verbose]");
+
+    unsigned cores = std::max(1u, std::thread::hardware_concurrency());
+
+    cmdline.add_options()
+        ( "help,h"
+        , "print out program usage (this message)")
+
+        ( "port"
+        , po::value<unsigned short>()->default_value(2000)
+        , "TCP port to listen on")
+
+        ( "threads"
+        , po::value<unsigned>()->default_value(cores)
+        , "number of threads running the io_service")
+
+        ( "verbose"
+        , "print every message received")
+    ;
+
+    po::store(po::command_line_parser(argc, argv).options(cmdline).run(), vm);
+
+    po::notify(vm);
+
+    // Print help screen.
+    if (vm.count("help"))
+    {
+        std::cout << cmdline;
+        return 1;
+    }
+
+    try
+    {
+        asio::io_service io_service;
+
+        server srv(io_service
+                 , vm["port"].as<unsigned short>()
+                 , vm.count("verbose") != 0);
+
+        asio::signal_set signals(io_service, SIGINT, SIGTERM);
+        signals.async_wait(boost::bind(&asio::io_service::stop, &io_service));
+
+        unsigned threads = std::max(1u, vm["threads"].as<unsigned>());
+
+        std::vector<std::thread> pool;
+
+        for (unsigned i = 1; i < threads; ++i)
+            pool.emplace_back(boost::bind(&asio::io_service::run, &io_service));
+
+        // The main thread is part of the pool.
+        io_service.run();
+
+        for (std::thread& t : pool)
+            t.join();
+    }
     catch (std::exception& e)
     {
         std::cerr << e.what() << std::endl;
@@ -0,0 +1,668 @@
+// Copyright (c) 2012-2013 Bryce Adelstein-Lelbach
+// Copyright (c) 2003-2012 Christopher M. Kohlhoff (chris at kohlhoff dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+// Drives async_echo_server with many concurrent connections and records the
+// round-trip latency of every message in a histogram.
+//
+//   closed: each connection sends a message, waits for the echo and sends
+//           the next one. This finds the peak throughput, but its latencies
+//           are service times: while the server stalls we stop sending, so
+//           the stall shows up in one sample instead of all the messages we
+//           would have sent meanwhile (coordinated omission).
+//   open:   messages are sent on a fixed schedule at --rate messages/s (in
+//           total), whether or not earlier ones have come back, and latency
+//           is measured from when a message was *supposed* to be sent. A
+//           stall therefore counts against every message it delays.
+//   sweep:  a closed-loop run to find the peak, then open-loop runs at
+//           increasing fractions of it, printing the throughput-vs-latency
+//           curve.
+//
+// Usage: echo_load_generator [--mode closed|open|sweep] [--connections <n>]
+//                            [--size <bytes>] [--rate <msgs/s>]
+//                            [--duration <s>]
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <boost/bind.hpp>
+#include <boost/asio.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/program_options.hpp>
+
+using boost::system::error_code;
+namespace asio = boost::asio;
+namespace po = boost::program_options;
+typedef boost::asio::ip::tcp asio_tcp;
+
+typedef std::chrono::steady_clock clock_type;
+
+///////////////////////////////////////////////////////////////////////////////
+/// A log-linear histogram of latencies in nanoseconds, in the style of
+/// HdrHistogram: values below 2^sub_bucket_bits are counted exactly, and
+/// above that each power of two is split into 2^sub_bucket_bits buckets, so
+/// any recorded value is reported with a relative error below 1%.
+struct latency_histogram
+{
+  private:
+    static const unsigned sub_bucket_bits = 7;
+    static const boost::uint64_t sub_buckets =
+        boost::uint64_t(1) << sub_bucket_bits;
+
+    std::vector<boost::uint64_t> counts_;
+    boost::uint64_t total_;
+    boost::uint64_t max_;
+
+    static unsigned shift_of(boost::uint64_t v)
+    {
+        unsigned log2 = 63 - __builtin_clzll(v | 1);
+        return (log2 > sub_bucket_bits) ? (log2 - sub_bucket_bits) : 0;
+    }
+
+    static std::size_t index_of(boost::uint64_t v)
+    {
+        unsigned shift = shift_of(v);
+        return std::size_t(shift * sub_buckets + (v >> shift));
+    }
+
+    /// The largest value which falls into bucket i.
+    static boost::uint64_t value_of(std::size_t i)
+    {
+        unsigned shift = (i < 2 * sub_buckets)
+                       ? 0 : unsigned(i / sub_buckets - 1);
+        boost::uint64_t first = (i - shift * sub_buckets) << shift;
+        return first + (boost::uint64_t(1) << shift) - 1;
+    }
+
+  public:
+    latency_histogram()
+      : counts_(index_of(~boost::uint64_t(0)) + 1, 0)
+      , total_(0)
+      , max_(0)
+    {}
+
+    void record(boost::uint64_t ns)
+    {
+        ++counts_[index_of(ns)];
+        ++total_;
+        max_ = std::max(max_, ns);
+    }
+
+    void merge(latency_histogram const& other)
+    {
+        for (std::size_t i = 0; i < counts_.size(); ++i)
+            counts_[i] += other.counts_[i];
+        total_ += other.total_;
+        max_ = std::max(max_, other.max_);
+    }
+
+    boost::uint64_t count() const
+    {
+        return total_;
+    }
+
+    boost::uint64_t max() const
+    {
+        return max_;
+    }
+
+    /// The smallest value that at least fraction p of the samples are at
+    /// or below.
+    boost::uint64_t percentile(double p) const
+    {
+        if (total_ == 0)
+            return 0;
+
+        boost::uint64_t rank = boost::uint64_t(p * total_ + 0.5);
+        rank = std::max<boost::uint64_t>(1, std::min(rank, total_));
+
+        boost::uint64_t seen = 0;
+        for (std::size_t i = 0; i < counts_.size(); ++i)
+        {
+            seen += counts_[i];
+            if (seen >= rank)
+                return std::min(value_of(i), max_);
+        }
+
+        return max_;
+    }
+};
+
+///////////////////////////////////////////////////////////////////////////////
+struct load_options
+{
+    std::string host;
+    std::string port;
+    std::size_t connections;
+    std::size_t size;
+    unsigned threads;
+    double duration;
+    double drain;
+};
+
+/// One connection to the server. Messages due to be sent are queued with
+/// the time they were meant to go out; since the server echoes bytes in
+/// order, every size bytes read back complete the oldest queued message.
+/// Reads, writes and the send timer may complete on different threads, so
+/// all handlers go through a strand.
+struct load_connection
+{
+  private:
+    asio_tcp::socket socket_;
+    asio::io_service::strand strand_;
+    asio::steady_timer timer_;
+
+    std::vector<char> message_;
+    std::vector<char> in_buffer_;
+
+    bool open_loop_;
+    clock_type::duration interval_;
+    clock_type::time_point next_send_;
+
+    std::deque<clock_type::time_point> pending_;
+    std::size_t unsent_;
+    std::size_t partial_;
+    bool writing_;
+    bool stopping_;
+    std::atomic<bool> done_;
+
+  public:
+    latency_histogram histogram;
+    boost::uint64_t errors;
+
+    load_connection(
+        asio::io_service& io_service
+      , std::size_t size
+      , bool open_loop
+      , clock_type::duration interval
+        )
+      : socket_(io_service)
+      , strand_(io_service)
+      , timer_(io_service)
+      , message_(size, 'x')
+      , in_buffer_(std::max<std::size_t>(size, 64 * 1024))
+      , open_loop_(open_loop)
+      , interval_(interval)
+      , unsent_(0)
+      , partial_(0)
+      , writing_(false)
+      , stopping_(false)
+      , done_(false)
+      , errors(0)
+    {}
+
+    void connect(asio_tcp::resolver::iterator endpoints)
+    {
+        asio::connect(socket_, endpoints);
+        socket_.set_option(asio_tcp::no_delay(true));
+    }
+
+    /// Starts sending, with the first message due at first_send.
+    void start(clock_type::time_point first_send)
+    {
+        strand_.dispatch(boost::bind(&load_connection::handle_start
+                                   , this
+                                   , first_send));
+    }
+
+    /// Stops sending; the connection is done once every message sent has
+    /// been echoed.
+    void stop()
+    {
+        strand_.dispatch(boost::bind(&load_connection::handle_stop, this));
+    }
+
+    /// Gives up on the messages still outstanding. They are recorded with
+    /// the time they have waited so far, so that a server which stopped
+    /// answering doesn't look fast.
+    void abort()
+    {
+        strand_.dispatch(boost::bind(&load_connection::handle_abort, this));
+    }
+
+    bool done() const
+    {
+        return done_.load();
+    }
+
+  private:
+    void handle_start(clock_type::time_point first_send)
+    {
+        async_read();
+
+        if (open_loop_)
+        {
+            next_send_ = first_send;
+            async_wait();
+        }
+        else
+            enqueue(clock_type::now());
+    }
+
+    void handle_stop()
+    {
+        stopping_ = true;
+        timer_.cancel();
+        finish_if_drained();
+    }
+
+    void handle_abort()
+    {
+        if (done_.load())
+            return;
+
+        clock_type::time_point now = clock_type::now();
+
+        for (clock_type::time_point sent : pending_)
+            record(now - sent);
+
+        pending_.clear();
+        close();
+    }
+
+    void enqueue(clock_type::time_point intended)
+    {
+        pending_.push_back(intended);
+        ++unsent_;
+        async_write();
+    }
+
+    void async_wait()
+    {
+        timer_.expires_at(next_send_);
+        timer_.async_wait(strand_.wrap(
+            boost::bind(&load_connection::handle_wait
+                      , this
+                      , asio::placeholders::error)));
+    }
+
+    void handle_wait(error_code const& error)
+    {
+        if (error || stopping_) return;
+
+        // Queue everything that has come due, even if we have fallen
+        // behind; each message keeps its own scheduled send time.
+        clock_type::time_point now = clock_type::now();
+
+        while (next_send_ <= now)
+        {
+            pending_.push_back(next_send_);
+            ++unsent_;
+            next_send_ += interval_;
+        }
+
+        async_write();
+        async_wait();
+    }
+
+    void async_write()
+    {
+        if (writing_ || unsent_ == 0)
+            return;
+
+        // Send everything queued with a single gathered write.
+        std::vector<asio::const_buffer> buffers(unsent_
+                                              , asio::buffer(message_));
+        unsent_ = 0;
+        writing_ = true;
+
+        asio::async_write(socket_, buffers, strand_.wrap(
+            boost::bind(&load_connection::handle_write
+                      , this
+                      , asio::placeholders::error)));
+    }
+
+    void handle_write(error_code const& error)
+    {
+        writing_ = false;
+
+        if (done_.load()) return;
+
+        if (error) return fail();
+
+        async_write();
+    }
+
+    void async_read()
+    {
+        socket_.async_read_some(asio::buffer(in_buffer_), strand_.wrap(
+            boost::bind(&load_connection::handle_read
+                      , this
+                      , asio::placeholders::error
+                      , asio::placeholders::bytes_transferred)));
+    }
+
+    void handle_read(error_code const& error, std::size_t bytes)
+    {
+        if (done_.load()) return;
+
+        if (error) return fail();
+
+        clock_type::time_point now = clock_type::now();
+
+        partial_ += bytes;
+
+        while (partial_ >= message_.size() && !pending_.empty())
+        {
+            partial_ -= message_.size();
+
+            record(now - pending_.front());
+            pending_.pop_front();
+
+            // A closed loop sends the next message as soon as the last one
+            // has come back.
+            if (!open_loop_ && !stopping_)
+                enqueue(now);
+        }
+
+        if (finish_if_drained())
+            return;
+
+        async_read();
+    }
+
+    void record(clock_type::duration latency)
+    {
+        histogram.record(boost::uint64_t(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(latency)
+                .count()));
+    }
+
+    bool finish_if_drained()
+    {
+        if (!stopping_ || !pending_.empty())
+            return false;
+
+        close();
+        return true;
+    }
+
+    void fail()
+    {
+        ++errors;
+        pending_.clear();
+        close();
+    }
+
+    void close()
+    {
+        error_code ec;
+        timer_.cancel();
+        socket_.close(ec);
+        done_.store(true);
+    }
+};
+
+///////////////////////////////////////////////////////////////////////////////
+struct load_result
+{
+    double seconds;
+    boost::uint64_t errors;
+    latency_histogram histogram;
+};
+
+/// Runs one load test. A rate of 0 means closed-loop.
+load_result run_load(load_options const& opts, double rate)
+{
+    bool open_loop = rate > 0;
+
+    // Each connection sends at an equal share of the total rate.
+    clock_type::duration interval(0);
+    if (open_loop)
+        interval = std::chrono::duration_cast<clock_type::duration>(
+            std::chrono::duration<double>(opts.connections / rate));
+
+    asio::io_service io_service;
+    std::unique_ptr<asio::io_service::work>
+        work(new asio::io_service::work(io_service));
+
+    asio_tcp::resolver resolver(io_service);
+    asio_tcp::resolver::iterator endpoints =
+        resolver.resolve(asio_tcp::resolver::query(opts.host, opts.port));
+
+    std::vector<std::unique_ptr<load_connection> > conns;
+
+    for (std::size_t i = 0; i < opts.connections; ++i)
+    {
+        conns.emplace_back(new load_connection(io_service
+                                             , opts.size
+                                             , open_loop
+                                             , interval));
+        conns.back()->connect(endpoints);
+    }
+
+    std::vector<std::thread> threads;
+    for (unsigned i = 0; i < opts.threads; ++i)
+        threads.emplace_back(boost::bind(&asio::io_service::run, &io_service));
+
+    clock_type::time_point start = clock_type::now();
+
+    // Stagger the schedules, so that the connections don't all send at once.
+    for (std::size_t i = 0; i < conns.size(); ++i)
+        conns[i]->start(start + interval * i / conns.size());
+
+    std::this_thread::sleep_for(std::chrono::duration<double>(opts.duration));
+
+    for (auto& c : conns)
+        c->stop();
+
+    // Rates are over the time we were sending, not the time spent draining.
+    double seconds =
+        std::chrono::duration<double>(clock_type::now() - start).count();
+
+    clock_type::time_point deadline = clock_type::now()
+        + std::chrono::duration_cast<clock_type::duration>(
+              std::chrono::duration<double>(opts.drain));
+
+    auto all_done = [&]()
+        {
+            for (auto& c : conns)
+                if (!c->done())
+                    return false;
+            return true;
+        };
+
+    while (!all_done() && clock_type::now() < deadline)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+    for (auto& c : conns)
+        c->abort();
+
+    while (!all_done())
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+    load_result r;
+    r.seconds = seconds;
+    r.errors = 0;
+
+    work.reset();
+    for (std::thread& t : threads)
+        t.join();
+
+    for (auto& c : conns)
+    {
+        r.histogram.merge(c->histogram);
+        r.errors += c->errors;
+    }
+
+    return r;
+}
+
+void print_header()
+{
+    std::cout << std::setw(12) << "target/s"
+              << std::setw(12) << "achieved/s"
+              << std::setw(10) << "p50 us"
+              << std::setw(10) << "p90 us"
+              << std::setw(10) << "p99 us"
+              << std::setw(10) << "p99.9 us"
+              << std::setw(10) << "max us"
+              << std::setw(8) << "errors" << "\n";
+}
+
+void print_row(double rate, load_result const& r)
+{
+    latency_histogram const& h = r.histogram;
+
+    std::cout << std::fixed << std::setprecision(0)
+              << std::setw(12);
+
+    if (rate > 0)
+        std::cout << rate;
+    else
+        std::cout << "closed";
+
+    std::cout << std::setw(12) << (h.count() / r.seconds)
+              << std::setprecision(1)
+              << std::setw(10) << (h.percentile(0.5) / 1e3)
+              << std::setw(10) << (h.percentile(0.9) / 1e3)
+              << std::setw(10) << (h.percentile(0.99) / 1e3)
+              << std::setw(10) << (h.percentile(0.999) / 1e3)
+              << std::setw(10) << (h.max() / 1e3)
+              << std::setw(8) << r.errors << "\n";
+}
+
+int main(int argc, char** argv)
+{
+    // Parse command line.
+    po::variables_map vm;
+
+    po::options_description
+        cmdline("Usage: echo_load_generator [--host <host>] [--port <port>]"
+                " [--mode closed|open|sweep] [--connections <n>]"
+                " [--size <bytes>] [--rate <msgs/s>] [--duration <s>]");
+
+    unsigned cores = std::max(1u, std::thread::hardware_concurrency());
+
+    cmdline.add_options()
+        ( "help,h"
+        , "print out program usage (this message)")
+
+        ( "host"
+        , po::value<std::string>()->default_value("localhost")
+        , "hostname or IP of the echo server")
+
+        ( "port"
+        , po::value<std::string>()->default_value("2000")
+        , "TCP port of the echo server")
+
+        ( "mode"
+        , po::value<std::string>()->default_value("closed")
+        , "closed, open or sweep")
+
+        ( "connections"
+        , po::value<std::size_t>()->default_value(16)
+        , "number of concurrent connections")
+
+        ( "threads"
+        , po::value<unsigned>()->default_value(cores)
+        , "number of threads running the connections")
+
+        ( "size"
+        , po::value<std::size_t>()->default_value(64)
+        , "message size in bytes")
+
+        ( "rate"
+        , po::value<double>()->default_value(10000)
+        , "messages per second, over all connections (open mode)")
+
+        ( "steps"
+        , po::value<unsigned>()->default_value(10)
+        , "number of open-loop rates to try (sweep mode)")
+
+        ( "duration"
+        , po::value<double>()->default_value(5)
+        , "seconds to send for, per run")
+
+        ( "drain"
+        , po::value<double>()->default_value(1)
+        , "seconds to wait for outstanding echoes after each run")
+    ;
+
+    po::store(po::command_line_parser(argc, argv).options(cmdline).run(), vm);
+
+    po::notify(vm);
+
+    // Print help screen.
+    if (vm.count("help"))
+    {
+        std::cout << cmdline;
+        return 1;
+    }
+
+    load_options opts;
+    opts.host = vm["host"].as<std::string>();
+    opts.port = vm["port"].as<std::string>();
+    opts.connections =
+        std::max<std::size_t>(1, vm["connections"].as<std::size_t>());
+    opts.size = std::max<std::size_t>(1, vm["size"].as<std::size_t>());
+    opts.threads = std::max(1u, vm["threads"].as<unsigned>());
+    opts.duration = vm["duration"].as<double>();
+    opts.drain = vm["drain"].as<double>();
+
+    std::string mode = vm["mode"].as<std::string>();
+
+    std::cout << "connections: " << opts.connections
+              << "  size: " << opts.size
+              << "  threads: " << opts.threads << "\n";
+
+    try
+    {
+        if (mode == "closed")
+        {
+            print_header();
+            print_row(0, run_load(opts, 0));
+        }
+
+        else if (mode == "open")
+        {
+            double rate = vm["rate"].as<double>();
+
+            print_header();
+            print_row(rate, run_load(opts, rate));
+        }
+
+        else if (mode == "sweep")
+        {
+            unsigned steps = std::max(1u, vm["steps"].as<unsigned>());
+
+            print_header();
+
+            load_result peak = run_load(opts, 0);
+            print_row(0, peak);
+
+            double peak_rate = peak.histogram.count() / peak.seconds;
+
+            // Go a little past the closed-loop peak, to show the knee.
+            for (unsigned i = 1; i <= steps; ++i)
+            {
+                double rate = peak_rate * 1.1 * i / steps;
+                print_row(rate, run_load(opts, rate));
+            }
+        }
+
+        else
+        {
+            std::cerr << "unknown mode: " << mode << "\n";
+            return 1;
+        }
+    }
+    catch (std::exception& e)
+    {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
+
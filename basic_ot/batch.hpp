@@ -0,0 +1,61 @@
+// Copyright (c) 2012-2013 Bryce Adelstein-Lelbach
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+#if !defined(CPPNOW_1CDCB57B_151D_4E6C_BF8D_9BF42391309D)
+#define CPPNOW_1CDCB57B_151D_4E6C_BF8D_9BF42391309D
+
+#include <boost/cstdint.hpp>
+#include <boost/static_assert.hpp>
+
+#include "coordinate.hpp"
+
+///////////////////////////////////////////////////////////////////////////////
+/// The wire format spoken between ot_client and ot_server. A client opens
+/// the stream with a stream_header and then sends any number of batches,
+/// each a batch_header followed by count raw coordinates:
+///
+///     stream_header
+///     batch_header  coordinate[count]
+///     batch_header  coordinate[count]
+///     ...
+///
+/// Everything is in native byte order, so that a batch can be sent straight
+/// from (and received straight into) an array of coordinates. The magic
+/// number in the stream_header doubles as an endianness check: a peer with
+/// the other byte order sees it byte-swapped and hangs up.
+struct stream_header
+{
+    static const boost::uint32_t expected_magic = 0x4F54434F;
+
+    boost::uint32_t magic;
+    boost::uint32_t coordinate_size;
+
+    static stream_header local()
+    {
+        stream_header h = { expected_magic, sizeof(coordinate) };
+        return h;
+    }
+
+    bool compatible() const
+    {
+        return magic == expected_magic
+            && coordinate_size == sizeof(coordinate);
+    }
+};
+
+struct batch_header
+{
+    /// The largest batch we accept (16MiB of coordinates), so that a corrupt
+    /// header can't make the server allocate arbitrary amounts of memory.
+    static const boost::uint64_t max_count = boost::uint64_t(1) << 20;
+
+    boost::uint64_t count;
+};
+
+BOOST_STATIC_ASSERT(sizeof(stream_header) == 8);
+BOOST_STATIC_ASSERT(sizeof(batch_header) == 8);
+
+#endif
+
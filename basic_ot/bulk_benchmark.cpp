@@ -0,0 +1,174 @@
+// Copyright (c) 2012-2013 Bryce Adelstein-Lelbach
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+// Compares ways of writing a std::vector<coordinate> through the binary
+// archives:
+//
+//   fieldwise: field by field, the way coordinate used to be written
+//              (modelled by fieldwise_coordinate, which is not marked as
+//              bitwise serializable).
+//   bitwise:   a single raw copy of the whole array.
+//   delta:     columnar delta encoding and bit-packing (coordinate_codec).
+//
+// The coordinates are a random walk, like the point sets we send.
+//
+// Usage: bulk_benchmark [count]
+
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+#include <boost/lexical_cast.hpp>
+#include <boost/iostreams/stream.hpp>
+#include <boost/iostreams/device/array.hpp>
+#include <boost/archive/binary_oarchive.hpp>
+#include <boost/archive/binary_iarchive.hpp>
+#include <boost/serialization/vector.hpp>
+
+#include "coordinate.hpp"
+#include "coordinate_codec.hpp"
+
+struct fieldwise_coordinate
+{
+    boost::uint64_t x;
+    boost::uint64_t y;
+
+    template <typename Archive>
+    void serialize(Archive& ar, const unsigned)
+    {
+        ar & x;
+        ar & y;
+    }
+};
+
+struct as_vector
+{
+    template <typename Archive, typename Coordinate>
+    void operator()(Archive& ar, std::vector<Coordinate>& v) const
+    {
+        ar & v;
+    }
+};
+
+struct as_delta_packed
+{
+    template <typename Archive>
+    void operator()(Archive& ar, std::vector<coordinate>& v) const
+    {
+        ar & make_delta_packed(v);
+    }
+};
+
+typedef std::chrono::high_resolution_clock clock_type;
+
+double seconds_since(clock_type::time_point start)
+{
+    return std::chrono::duration<double>(clock_type::now() - start).count();
+}
+
+template <typename Coordinate, typename Method>
+void benchmark(
+    std::string const& name
+  , std::vector<coordinate> const& data
+  , Method method
+    )
+{
+    std::size_t count = data.size();
+
+    std::vector<Coordinate> in(count);
+    for (std::size_t i = 0; i < count; ++i)
+    {
+        in[i].x = data[i].x;
+        in[i].y = data[i].y;
+    }
+
+    // Write into a preallocated buffer so that we only measure the archive.
+    std::vector<char> buffer(count * sizeof(Coordinate) * 2 + 4096);
+
+    clock_type::time_point start = clock_type::now();
+
+    std::streamsize bytes = 0;
+
+    {
+        boost::iostreams::stream<boost::iostreams::array_sink>
+            s(buffer.data(), buffer.size());
+
+        {
+            boost::archive::binary_oarchive sa(s);
+            method(sa, in);
+        }
+
+        bytes = s.tellp();
+    }
+
+    double save_time = seconds_since(start);
+
+    std::vector<Coordinate> out;
+
+    start = clock_type::now();
+
+    {
+        boost::iostreams::stream<boost::iostreams::array_source>
+            s(buffer.data(), bytes);
+
+        boost::archive::binary_iarchive la(s);
+        method(la, out);
+    }
+
+    double load_time = seconds_since(start);
+
+    bool ok = out.size() == in.size();
+    for (std::size_t i = 0; ok && i < count; ++i)
+        ok = (out[i].x == in[i].x) && (out[i].y == in[i].y);
+
+    double mb = double(count * sizeof(Coordinate)) / (1024 * 1024);
+
+    std::cout << std::left << std::setw(10) << name << std::right
+              << std::fixed << std::setprecision(2)
+              << std::setw(12) << (save_time * 1e9 / count)
+              << std::setw(12) << (load_time * 1e9 / count)
+              << std::setprecision(0)
+              << std::setw(12) << (mb / save_time)
+              << std::setw(12) << (mb / load_time)
+              << std::setprecision(2)
+              << std::setw(12) << (double(bytes) / count)
+              << (ok ? "" : "  MISMATCH") << "\n";
+}
+
+int main(int argc, char** argv)
+{
+    std::size_t count = 10000000;
+
+    if (argc > 1)
+        count = boost::lexical_cast<std::size_t>(argv[1]);
+
+    std::mt19937_64 gen(42);
+    std::uniform_int_distribution<int> step(-64, 64);
+
+    std::vector<coordinate> data(count);
+    boost::uint64_t x = 1u << 30, y = 1u << 30;
+    for (coordinate& c : data)
+    {
+        c.x = x += step(gen);
+        c.y = y += step(gen);
+    }
+
+    // MB/s are in terms of the in-memory size of the coordinates.
+    std::cout << count << " coordinates\n"
+              << std::left << std::setw(10) << "path" << std::right
+              << std::setw(12) << "save ns/obj"
+              << std::setw(12) << "load ns/obj"
+              << std::setw(12) << "save MB/s"
+              << std::setw(12) << "load MB/s"
+              << std::setw(12) << "bytes/obj" << "\n";
+
+    benchmark<fieldwise_coordinate>("fieldwise", data, as_vector());
+    benchmark<coordinate>("bitwise", data, as_vector());
+    benchmark<coordinate>("delta", data, as_delta_packed());
+
+    return 0;
+}
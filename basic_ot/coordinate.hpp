@@ -7,6 +7,11 @@
 #define CPPNOW_677B0E1E_FFE2_4EFF_91AE_F6F99282EE99
 
 #include <boost/cstdint.hpp>
+#include <boost/static_assert.hpp>
+#include <boost/type_traits/is_pod.hpp>
+#include <boost/serialization/level.hpp>
+#include <boost/serialization/tracking.hpp>
+#include <boost/serialization/is_bitwise_serializable.hpp>
 
 struct coordinate
 {
@@ -21,5 +26,17 @@ struct coordinate
     }
 };
 
+// coordinate is plain data without padding, so arrays of it (such as a
+// std::vector<coordinate>) can be written by the binary archives with a
+// single save_binary instead of two archive calls per element. The binary
+// archives check endianness and integer sizes in their header, so a raw
+// copy is only ever read back on a compatible machine.
+BOOST_STATIC_ASSERT(boost::is_pod<coordinate>::value);
+BOOST_STATIC_ASSERT(sizeof(coordinate) == 2 * sizeof(boost::uint64_t));
+
+BOOST_IS_BITWISE_SERIALIZABLE(coordinate);
+BOOST_CLASS_IMPLEMENTATION(coordinate, boost::serialization::object_serializable);
+BOOST_CLASS_TRACKING(coordinate, boost::serialization::track_never);
+
 #endif
 
@@ -0,0 +1,381 @@
+// Copyright (c) 2012-2013 Bryce Adelstein-Lelbach
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+#if !defined(CPPNOW_714777D9_CB2C_4FDB_891A_F3B4FFDD9627)
+#define CPPNOW_714777D9_CB2C_4FDB_891A_F3B4FFDD9627
+
+#include <cstring>
+#include <vector>
+
+#include <boost/assert.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/archive/archive_exception.hpp>
+#include <boost/serialization/nvp.hpp>
+#include <boost/serialization/level.hpp>
+#include <boost/serialization/tracking.hpp>
+#include <boost/serialization/wrapper.hpp>
+#include <boost/serialization/split_member.hpp>
+
+#include "coordinate.hpp"
+
+///////////////////////////////////////////////////////////////////////////////
+/// A columnar codec for batches of coordinates. Consecutive coordinates in
+/// our point sets are highly correlated, so instead of writing each 16 byte
+/// coordinate as is, we:
+///
+///   1. transpose blocks of block_size coordinates into an x and a y column,
+///   2. replace each value by its zigzag encoded difference to the previous
+///      value in the same column, and
+///   3. bit-pack each column of a block with the smallest width that fits
+///      all of its deltas.
+///
+/// The delta, zigzag and transpose steps are simple loops over fixed size
+/// blocks, which GCC vectorizes at -O3. Bit packing and unpacking stay
+/// scalar: each value lands at a data dependent shift and may straddle two
+/// words.
+///
+/// Format (words in native byte order, like the binary archives, which
+/// check endianness in their header):
+///
+///     uint64_t count
+///     per block, per column (x, then y):
+///         uint64_t base      (the first value of the column)
+///         uint8_t  width     (0..64)
+///         uint64_t packed[(n * width + 63) / 64]
+///
+/// where n is the number of coordinates in the block (block_size, except
+/// for the last block). Each block starts from its own base, so a jump in
+/// the data only widens the block it is in.
+namespace coordinate_codec
+{
+
+static const std::size_t block_size = 128;
+
+/// The largest encoding that delta_packed_coordinates will load. Its size
+/// comes from the stream, and is allocated before anything else is checked.
+static const boost::uint64_t max_encoded_size = boost::uint64_t(1) << 30;
+
+namespace detail
+{
+
+inline boost::uint64_t zigzag(boost::uint64_t delta)
+{
+    return (delta << 1) ^ (0 - (delta >> 63));
+}
+
+inline boost::uint64_t unzigzag(boost::uint64_t v)
+{
+    return (v >> 1) ^ (0 - (v & 1));
+}
+
+/// Replaces column by the zigzag deltas of its values (the first delta is
+/// always 0) and returns the number of bits needed to store the largest of
+/// them.
+inline unsigned delta_encode(boost::uint64_t* column)
+{
+    boost::uint64_t deltas[block_size];
+
+    deltas[0] = 0;
+    for (std::size_t i = 1; i < block_size; ++i)
+        deltas[i] = zigzag(column[i] - column[i - 1]);
+
+    boost::uint64_t bits = 0;
+    for (std::size_t i = 0; i < block_size; ++i)
+    {
+        column[i] = deltas[i];
+        bits |= deltas[i];
+    }
+
+    unsigned width = 0;
+    while (width < 64 && (bits >> width) != 0)
+        ++width;
+    return width;
+}
+
+/// The inverse of delta_encode, given the first value of the column.
+inline void delta_decode(boost::uint64_t* column, boost::uint64_t prev)
+{
+    for (std::size_t i = 0; i < block_size; ++i)
+        column[i] = unzigzag(column[i]);
+
+    for (std::size_t i = 0; i < block_size; ++i)
+    {
+        prev += column[i];
+        column[i] = prev;
+    }
+}
+
+/// The number of words needed to pack n values of width bits each.
+inline std::size_t packed_words(std::size_t n, unsigned width)
+{
+    return (n * width + 63) / 64;
+}
+
+/// Packs n values of width bits each into packed_words(n, width) words.
+inline void pack(
+    boost::uint64_t const* column
+  , std::size_t n
+  , unsigned width
+  , boost::uint64_t* out
+    )
+{
+    if (width == 0)
+        return;
+
+    std::memset(out, 0, packed_words(n, width) * sizeof(*out));
+
+    for (std::size_t i = 0; i < n; ++i)
+    {
+        std::size_t bit = i * width;
+        std::size_t word = bit / 64;
+        unsigned shift = bit % 64;
+
+        out[word] |= column[i] << shift;
+
+        // The value straddles two words.
+        if (shift + width > 64)
+            out[word + 1] |= column[i] >> (64 - shift);
+    }
+}
+
+/// The inverse of pack. Values past n are set to 0.
+inline void unpack(
+    boost::uint64_t const* in
+  , std::size_t n
+  , unsigned width
+  , boost::uint64_t* column
+    )
+{
+    std::memset(column, 0, block_size * sizeof(*column));
+
+    if (width == 0)
+        return;
+
+    boost::uint64_t const mask =
+        (width == 64) ? ~boost::uint64_t(0)
+                      : ((boost::uint64_t(1) << width) - 1);
+
+    for (std::size_t i = 0; i < n; ++i)
+    {
+        std::size_t bit = i * width;
+        std::size_t word = bit / 64;
+        unsigned shift = bit % 64;
+
+        boost::uint64_t v = in[word] >> shift;
+
+        // The value straddles two words.
+        if (shift + width > 64)
+            v |= in[word + 1] << (64 - shift);
+
+        column[i] = v & mask;
+    }
+}
+
+inline void append(std::vector<char>& out, void const* p, std::size_t size)
+{
+    char const* first = static_cast<char const*>(p);
+    out.insert(out.end(), first, first + size);
+}
+
+/// The fewest bytes a block can be encoded in: a base and a width per
+/// column, and no packed words.
+static const std::size_t min_block_bytes = 2 * (sizeof(boost::uint64_t) + 1);
+
+inline void consume(
+    char const*& first
+  , char const* last
+  , void* p
+  , std::size_t size
+    )
+{
+    if (std::size_t(last - first) < size)
+        throw boost::archive::archive_exception(
+            boost::archive::archive_exception::input_stream_error);
+    std::memcpy(p, first, size);
+    first += size;
+}
+
+}
+
+/// Appends the encoding of the n coordinates starting at in to out.
+inline void encode(coordinate const* in, std::size_t n, std::vector<char>& out)
+{
+    // Reserve for the worst case (every delta 64 bits wide), so that we
+    // never reallocate while appending blocks.
+    std::size_t blocks = (n + block_size - 1) / block_size;
+    out.reserve(out.size() + sizeof(boost::uint64_t)
+              + n * sizeof(coordinate) + blocks * 2 * 9);
+
+    boost::uint64_t count = n;
+    detail::append(out, &count, sizeof(count));
+
+    boost::uint64_t xs[block_size];
+    boost::uint64_t ys[block_size];
+    boost::uint64_t packed[block_size];
+
+    for (std::size_t first = 0; first < n; first += block_size)
+    {
+        std::size_t size = (n - first < block_size) ? (n - first) : block_size;
+
+        // Transpose into columns, padding the last block.
+        for (std::size_t i = 0; i < size; ++i)
+        {
+            xs[i] = in[first + i].x;
+            ys[i] = in[first + i].y;
+        }
+        for (std::size_t i = size; i < block_size; ++i)
+        {
+            xs[i] = xs[size - 1];
+            ys[i] = ys[size - 1];
+        }
+
+        boost::uint64_t* columns[2] = { xs, ys };
+
+        for (std::size_t c = 0; c < 2; ++c)
+        {
+            boost::uint64_t base = columns[c][0];
+
+            unsigned width = detail::delta_encode(columns[c]);
+            detail::pack(columns[c], size, width, packed);
+
+            unsigned char w = static_cast<unsigned char>(width);
+            detail::append(out, &base, sizeof(base));
+            detail::append(out, &w, 1);
+            detail::append(out, packed, detail::packed_words(size, width)
+                                      * sizeof(boost::uint64_t));
+        }
+    }
+}
+
+/// Decodes [first, last) into out, replacing its contents. Returns the end
+/// of the encoded data. Throws archive_exception::input_stream_error if the
+/// input is truncated or corrupt.
+inline char const* decode(
+    char const* first
+  , char const* last
+  , std::vector<coordinate>& out
+    )
+{
+    boost::uint64_t count = 0;
+    detail::consume(first, last, &count, sizeof(count));
+
+    // Don't trust count to allocate before checking that the input can hold
+    // that many blocks.
+    boost::uint64_t blocks = count / block_size + (count % block_size != 0);
+
+    if (blocks > std::size_t(last - first) / detail::min_block_bytes)
+        throw boost::archive::archive_exception(
+            boost::archive::archive_exception::input_stream_error);
+
+    out.resize(count);
+
+    boost::uint64_t columns[2][block_size];
+    boost::uint64_t packed[block_size];
+
+    for (std::size_t begin = 0; begin < count; begin += block_size)
+    {
+        std::size_t size =
+            (count - begin < block_size) ? (count - begin) : block_size;
+
+        for (std::size_t c = 0; c < 2; ++c)
+        {
+            boost::uint64_t base = 0;
+            detail::consume(first, last, &base, sizeof(base));
+
+            unsigned char w = 0;
+            detail::consume(first, last, &w, 1);
+
+            if (w > 64)
+                throw boost::archive::archive_exception(
+                    boost::archive::archive_exception::input_stream_error);
+
+            detail::consume(first, last, packed
+                , detail::packed_words(size, w) * sizeof(boost::uint64_t));
+
+            detail::unpack(packed, size, w, columns[c]);
+            detail::delta_decode(columns[c], base);
+        }
+
+        // Transpose back.
+        for (std::size_t i = 0; i < size; ++i)
+        {
+            out[begin + i].x = columns[0][i];
+            out[begin + i].y = columns[1][i];
+        }
+    }
+
+    return first;
+}
+
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// Serialization wrapper which writes a std::vector<coordinate> through
+/// coordinate_codec instead of as raw memory:
+///
+///     ar & make_delta_packed(coordinates);
+struct delta_packed_coordinates
+{
+  private:
+    std::vector<coordinate>& coordinates_;
+
+  public:
+    explicit delta_packed_coordinates(std::vector<coordinate>& coordinates)
+      : coordinates_(coordinates)
+    {}
+
+    template <typename Archive>
+    void save(Archive& ar, const unsigned) const
+    {
+        std::vector<char> buffer;
+        coordinate_codec::encode(coordinates_.data(), coordinates_.size()
+                               , buffer);
+
+        boost::uint64_t size = buffer.size();
+        ar << boost::serialization::make_nvp("size", size);
+        ar.save_binary(buffer.data(), buffer.size());
+    }
+
+    template <typename Archive>
+    void load(Archive& ar, const unsigned)
+    {
+        boost::uint64_t size = 0;
+        ar >> boost::serialization::make_nvp("size", size);
+
+        if (size > coordinate_codec::max_encoded_size)
+            throw boost::archive::archive_exception(
+                boost::archive::archive_exception::input_stream_error);
+
+        std::vector<char> buffer(size);
+        ar.load_binary(buffer.data(), buffer.size());
+
+        coordinate_codec::decode(buffer.data(), buffer.data() + buffer.size()
+                               , coordinates_);
+    }
+
+    BOOST_SERIALIZATION_SPLIT_MEMBER()
+};
+
+BOOST_CLASS_IMPLEMENTATION(delta_packed_coordinates
+                         , boost::serialization::object_serializable);
+BOOST_CLASS_TRACKING(delta_packed_coordinates
+                   , boost::serialization::track_never);
+BOOST_CLASS_IS_WRAPPER(delta_packed_coordinates);
+
+inline delta_packed_coordinates const
+make_delta_packed(std::vector<coordinate>& coordinates)
+{
+    return delta_packed_coordinates(coordinates);
+}
+
+inline delta_packed_coordinates const
+make_delta_packed(std::vector<coordinate> const& coordinates)
+{
+    return delta_packed_coordinates(
+        const_cast<std::vector<coordinate>&>(coordinates));
+}
+
+#endif
+
@@ -4,25 +4,317 @@
 // Distributed under the Boost Software License, Version 1.0. (See accompanying
 // file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
 
+// Sends coordinates to ot_server. By default a single coordinate is sent.
+// With --file, a file of raw coordinates is memory-mapped and streamed to
+// the server in batches; each write gathers the batch headers and slices of
+// the mapping, so the file is never copied into our own buffers.
+//
+// Usage: ot_client --file coordinates.bin --generate 10000000
+//        ot_client --file coordinates.bin [--batch-size <n>] [--window <n>]
+//                  [--connections <n>]
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
 #include <iostream>
+#include <memory>
+#include <random>
 #include <string>
+#include <vector>
+
+#include <boost/bind.hpp>
 #include <boost/asio.hpp>
-#include <boost/archive/binary_oarchive.hpp>
+#include <boost/program_options.hpp>
+#include <boost/iostreams/device/mapped_file.hpp>
 
-#include "coordinate.hpp"
+#include "batch.hpp"
 
+using boost::system::error_code;
 namespace asio = boost::asio;
+namespace po = boost::program_options;
 typedef boost::asio::ip::tcp asio_tcp;
 
-int main()
+typedef std::chrono::steady_clock clock_type;
+
+///////////////////////////////////////////////////////////////////////////////
+/// Streams a contiguous range of coordinates over one connection. Each
+/// write covers up to window batches, as a single gathered write of their
+/// headers and payloads; the next write is issued when it completes.
+struct sender
+{
+  private:
+    asio_tcp::socket socket_;
+    coordinate const* coordinates_;
+    std::size_t count_;
+    std::size_t batch_size_;
+    std::size_t window_;
+
+    stream_header stream_header_;
+    std::vector<batch_header> headers_;
+    std::size_t next_batch_;
+
+  public:
+    sender(
+        asio::io_service& io_service
+      , coordinate const* coordinates
+      , std::size_t count
+      , std::size_t batch_size
+      , std::size_t window
+        )
+      : socket_(io_service)
+      , coordinates_(coordinates)
+      , count_(count)
+      , batch_size_(batch_size)
+      , window_(window)
+      , stream_header_(stream_header::local())
+      , next_batch_(0)
+    {
+        for (std::size_t first = 0; first < count_; first += batch_size_)
+        {
+            batch_header h = { std::min(batch_size_, count_ - first) };
+            headers_.push_back(h);
+        }
+    }
+
+    void start(asio_tcp::resolver::iterator endpoints)
+    {
+        asio::connect(socket_, endpoints);
+        socket_.set_option(asio_tcp::no_delay(true));
+
+        asio::write(socket_,
+            asio::buffer(&stream_header_, sizeof(stream_header_)));
+
+        async_write();
+    }
+
+  private:
+    void async_write()
+    {
+        if (next_batch_ == headers_.size())
+        {
+            // Let the server see the end of the stream.
+            error_code ec;
+            socket_.shutdown(asio_tcp::socket::shutdown_send, ec);
+            return;
+        }
+
+        std::size_t last = std::min(next_batch_ + window_, headers_.size());
+
+        std::vector<asio::const_buffer> buffers;
+        buffers.reserve(2 * (last - next_batch_));
+
+        for (std::size_t i = next_batch_; i < last; ++i)
+        {
+            buffers.push_back(
+                asio::buffer(&headers_[i], sizeof(batch_header)));
+            buffers.push_back(
+                asio::buffer(coordinates_ + i * batch_size_
+                           , headers_[i].count * sizeof(coordinate)));
+        }
+
+        next_batch_ = last;
+
+        asio::async_write(socket_, buffers,
+            boost::bind(&sender::handle_write
+                      , this
+                      , asio::placeholders::error));
+    }
+
+    void handle_write(error_code const& error)
+    {
+        if (error)
+        {
+            std::cerr << "write error: " << error.message() << "\n";
+            return;
+        }
+
+        async_write();
+    }
+};
+
+/// Writes count coordinates (a random walk, like our point sets) to path.
+void generate(std::string const& path, std::size_t count)
 {
-    asio_tcp::iostream s("localhost", "2000");
+    std::ofstream out(path.c_str(), std::ios::binary);
 
+    std::mt19937_64 gen(42);
+    std::uniform_int_distribution<int> step(-64, 64);
+
+    std::vector<coordinate> block(65536);
+    boost::uint64_t x = 1u << 30, y = 1u << 30;
+
+    for (std::size_t first = 0; first < count; first += block.size())
     {
-        boost::archive::binary_oarchive sa(s);
+        std::size_t size = std::min(block.size(), count - first);
+
+        for (std::size_t i = 0; i < size; ++i)
+        {
+            block[i].x = x += step(gen);
+            block[i].y = y += step(gen);
+        }
 
-        coordinate c{17, 42};
-        sa << c; 
+        out.write(reinterpret_cast<char const*>(block.data())
+                , size * sizeof(coordinate));
     }
 }
 
+int stream_file(
+    std::string const& host
+  , std::string const& port
+  , std::string const& path
+  , std::size_t batch_size
+  , std::size_t window
+  , std::size_t connections
+    )
+{
+    boost::iostreams::mapped_file_source file(path);
+
+    if (file.size() % sizeof(coordinate) != 0)
+    {
+        std::cerr << path << " is not a whole number of coordinates\n";
+        return 1;
+    }
+
+    coordinate const* coordinates =
+        reinterpret_cast<coordinate const*>(file.data());
+    std::size_t count = file.size() / sizeof(coordinate);
+
+    if (count == 0)
+    {
+        std::cerr << path << " is empty\n";
+        return 1;
+    }
+
+    asio::io_service io_service;
+
+    asio_tcp::resolver resolver(io_service);
+    asio_tcp::resolver::iterator endpoints =
+        resolver.resolve(asio_tcp::resolver::query(host, port));
+
+    clock_type::time_point start = clock_type::now();
+
+    // Each connection sends its own contiguous slice of the file.
+    std::vector<std::unique_ptr<sender> > senders;
+
+    std::size_t per_connection = (count + connections - 1) / connections;
+
+    for (std::size_t first = 0; first < count; first += per_connection)
+    {
+        senders.emplace_back(new sender(io_service
+                                      , coordinates + first
+                                      , std::min(per_connection, count - first)
+                                      , batch_size
+                                      , window));
+        senders.back()->start(endpoints);
+    }
+
+    io_service.run();
+
+    double seconds =
+        std::chrono::duration<double>(clock_type::now() - start).count();
+
+    double mb = double(file.size()) / (1024 * 1024);
+
+    std::cout << "coordinates:   " << count << "\n"
+              << "connections:   " << senders.size() << "\n"
+              << "seconds:       " << seconds << "\n"
+              << "coordinates/s: " << (count / seconds) << "\n"
+              << "MB/s:          " << (mb / seconds) << "\n";
+
+    return 0;
+}
+
+int main(int argc, char** argv)
+{
+    // Parse command line.
+    po::variables_map vm;
+
+    po::options_description
+        cmdline("Usage: ot_client [--host <host>] [--port <port>]"
+                " [--file <path> [--generate <n>] [--batch-size <n>]"
+                " [--window <n>] [--connections <n>]]");
+
+    cmdline.add_options()
+        ( "help,h"
+        , "print out program usage (this message)")
+
+        ( "host"
+        , po::value<std::string>()->default_value("localhost")
+        , "hostname or IP of the server")
+
+        ( "port"
+        , po::value<std::string>()->default_value("2000")
+        , "TCP port of the server")
+
+        ( "file"
+        , po::value<std::string>()
+        , "file of raw coordinates to stream to the server")
+
+        ( "generate"
+        , po::value<std::size_t>()
+        , "write this many coordinates to --file instead of sending it")
+
+        ( "batch-size"
+        , po::value<std::size_t>()->default_value(65536)
+        , "coordinates per batch")
+
+        ( "window"
+        , po::value<std::size_t>()->default_value(8)
+        , "batches per gathered write")
+
+        ( "connections"
+        , po::value<std::size_t>()->default_value(1)
+        , "number of connections to spread the file over")
+    ;
+
+    po::store(po::command_line_parser(argc, argv).options(cmdline).run(), vm);
+
+    po::notify(vm);
+
+    // Print help screen.
+    if (vm.count("help"))
+    {
+        std::cout << cmdline;
+        return 1;
+    }
+
+    std::string host = vm["host"].as<std::string>();
+    std::string port = vm["port"].as<std::string>();
+
+    if (vm.count("file"))
+    {
+        std::string path = vm["file"].as<std::string>();
+
+        if (vm.count("generate"))
+        {
+            generate(path, vm["generate"].as<std::size_t>());
+            return 0;
+        }
+
+        std::size_t batch_size = vm["batch-size"].as<std::size_t>();
+        if (batch_size > batch_header::max_count)
+            batch_size = batch_header::max_count;
+
+        std::size_t window = vm["window"].as<std::size_t>();
+        std::size_t connections = vm["connections"].as<std::size_t>();
+
+        return stream_file(host, port, path
+                         , std::max<std::size_t>(1, batch_size)
+                         , std::max<std::size_t>(1, window)
+                         , std::max<std::size_t>(1, connections));
+    }
+
+    asio_tcp::iostream s(host, port);
+
+    stream_header sh = stream_header::local();
+    s.write(reinterpret_cast<char const*>(&sh), sizeof(sh));
+
+    coordinate c{17, 42};
+
+    batch_header bh = { 1 };
+    s.write(reinterpret_cast<char const*>(&bh), sizeof(bh));
+    s.write(reinterpret_cast<char const*>(&c), sizeof(c));
+
+    return 0;
+}
+
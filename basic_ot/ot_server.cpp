@@ -4,34 +4,530 @@
 // Distributed under the Boost Software License, Version 1.0. (See accompanying
 // file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
 
+// Ingests streams of coordinate batches (see batch.hpp) from any number of
+// concurrent clients. Sockets are driven by a pool of I/O threads; each batch
+// is handed to a separate pool of worker threads for processing while the
+// session goes on reading the next one. Aggregate ingest throughput is
+// reported periodically and when the server exits.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <iostream>
-#include <string>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include <boost/bind.hpp>
 #include <boost/asio.hpp>
-#include <boost/archive/binary_iarchive.hpp>
+#include <boost/program_options.hpp>
 
-#include "coordinate.hpp"
+#include "batch.hpp"
 
+using boost::system::error_code;
 namespace asio = boost::asio;
+namespace po = boost::program_options;
 typedef boost::asio::ip::tcp asio_tcp;
 
-int main()
+typedef std::chrono::steady_clock clock_type;
+
+typedef std::vector<coordinate> batch_buffer;
+
+struct ingest_stats
 {
-    asio::io_service io_service;
+    std::atomic<boost::uint64_t> coordinates;
+    std::atomic<boost::uint64_t> batches;
+    std::atomic<boost::uint64_t> clients_active;
+    std::atomic<boost::uint64_t> clients_done;
+
+    /// An order-independent digest of everything we've ingested, so that the
+    /// work can't be optimized away and runs can be compared.
+    std::atomic<boost::uint64_t> checksum;
+
+    ingest_stats()
+      : coordinates(0)
+      , batches(0)
+      , clients_active(0)
+      , clients_done(0)
+      , checksum(0)
+    {}
+};
+
+/// The per-batch work. This stands in for what the real ingest service does
+/// with each batch, and touches every coordinate once.
+boost::uint64_t process_batch(batch_buffer const& batch)
+{
+    boost::uint64_t sum = 0;
+    for (coordinate const& c : batch)
+        sum += c.x * 31 + c.y;
+    return sum;
+}
+
+struct server;
+
+///////////////////////////////////////////////////////////////////////////////
+/// One client connection. At most window batches of a session are buffered
+/// at a time (one being read, the rest queued for or being processed by the
+/// workers); when they are all in use, the session stops reading until a
+/// worker returns one, which pushes back on the client through TCP.
+struct session : std::enable_shared_from_this<session>
+{
+  private:
+    server& server_;
+    asio_tcp::socket socket_;
+    asio::io_service::strand strand_;
+
+    stream_header stream_header_;
+    batch_header batch_header_;
+
+    std::vector<std::shared_ptr<batch_buffer> > free_buffers_;
+    std::shared_ptr<batch_buffer> in_buffer_;
+    std::size_t buffers_;
+    std::size_t window_;
+    bool paused_;
+
+  public:
+    session(server& srv, asio::io_service& io_service, std::size_t window);
+
+    asio_tcp::socket& get_socket()
+    {
+        return socket_;
+    }
+
+    void start();
+
+  private:
+    void handle_read_stream_header(error_code const& error);
+
+    void async_read_batch_header();
+
+    void handle_read_batch_header(error_code const& error);
+
+    void handle_read_batch(error_code const& error);
+
+    void process(std::shared_ptr<batch_buffer> buffer);
+
+    void release(std::shared_ptr<batch_buffer> buffer);
+
+    void finish(error_code const& error = error_code());
+};
+
+///////////////////////////////////////////////////////////////////////////////
+struct server
+{
+  private:
+    asio::io_service& io_service_;
+    asio::io_service& workers_;
+    asio_tcp::acceptor acceptor_;
+    std::size_t window_;
+    boost::uint64_t max_clients_;
+
+    /// Delays the next accept after a failed one (e.g. when we're out of
+    /// file descriptors), so that we don't spin on the error.
+    asio::steady_timer accept_timer_;
+    std::chrono::milliseconds accept_backoff_;
+
+    static std::chrono::milliseconds min_accept_backoff()
+    {
+        return std::chrono::milliseconds(10);
+    }
+
+    static std::chrono::milliseconds max_accept_backoff()
+    {
+        return std::chrono::milliseconds(1000);
+    }
+
+  public:
+    ingest_stats stats;
+
+    server(
+        asio::io_service& io_service
+      , asio::io_service& workers
+      , unsigned short port
+      , std::size_t window
+      , boost::uint64_t max_clients
+        )
+      : io_service_(io_service)
+      , workers_(workers)
+      , acceptor_(io_service, asio_tcp::endpoint(asio_tcp::v4(), port))
+      , window_(window)
+      , max_clients_(max_clients)
+      , accept_timer_(io_service)
+      , accept_backoff_(min_accept_backoff())
+    {
+        async_accept();
+    }
+
+    asio::io_service& get_workers()
+    {
+        return workers_;
+    }
+
+    void client_done()
+    {
+        --stats.clients_active;
+
+        // Stop once the requested number of clients has come and gone.
+        if (++stats.clients_done == max_clients_)
+            io_service_.stop();
+    }
+
+  private:
+    void async_accept()
+    {
+        std::shared_ptr<session> s(new session(*this, io_service_, window_));
+
+        acceptor_.async_accept(s->get_socket(),
+            boost::bind(&server::handle_accept
+                      , this
+                      , asio::placeholders::error
+                      , s));
+    }
+
+    void handle_accept(error_code const& error, std::shared_ptr<session> s)
+    {
+        if (!error)
+        {
+            ++stats.clients_active;
+            s->start();
+
+            accept_backoff_ = min_accept_backoff();
+            async_accept();
+            return;
+        }
+
+        // The acceptor has been closed; we're shutting down.
+        if (error == asio::error::operation_aborted)
+            return;
+
+        std::cerr << "accept failed: " << error.message()
+                  << "; retrying in " << accept_backoff_.count() << "ms\n";
+
+        accept_timer_.expires_from_now(accept_backoff_);
+        accept_timer_.async_wait(boost::bind(&server::handle_accept_backoff
+                                           , this
+                                           , asio::placeholders::error));
+
+        accept_backoff_ = std::min(accept_backoff_ * 2, max_accept_backoff());
+    }
+
+    void handle_accept_backoff(error_code const& error)
+    {
+        if (error) return;
+
+        async_accept();
+    }
+};
+
+///////////////////////////////////////////////////////////////////////////////
+session::session(server& srv, asio::io_service& io_service, std::size_t window)
+  : server_(srv)
+  , socket_(io_service)
+  , strand_(io_service)
+  , buffers_(0)
+  , window_(window)
+  , paused_(false)
+{}
+
+void session::start()
+{
+    socket_.set_option(asio_tcp::no_delay(true));
+
+    asio::async_read(socket_,
+        asio::buffer(&stream_header_, sizeof(stream_header_)),
+            strand_.wrap(
+                boost::bind(&session::handle_read_stream_header
+                          , shared_from_this()
+                          , asio::placeholders::error)));
+}
+
+void session::handle_read_stream_header(error_code const& error)
+{
+    if (error) return finish(error);
+
+    // Either not one of our clients, or one with a different byte order.
+    if (!stream_header_.compatible())
+    {
+        std::cerr << "rejecting client with an incompatible stream header\n";
+        return finish();
+    }
+
+    async_read_batch_header();
+}
+
+void session::async_read_batch_header()
+{
+    if (free_buffers_.empty())
+    {
+        // Every buffer is with the workers; wait for one to come back.
+        if (buffers_ == window_)
+        {
+            paused_ = true;
+            return;
+        }
+
+        free_buffers_.push_back(std::make_shared<batch_buffer>());
+        ++buffers_;
+    }
 
-    asio_tcp::endpoint endpoint(asio_tcp::v4(), 2000);
-    asio_tcp::acceptor acceptor(io_service, endpoint);
+    in_buffer_ = free_buffers_.back();
+    free_buffers_.pop_back();
 
-    asio_tcp::iostream s;
+    asio::async_read(socket_,
+        asio::buffer(&batch_header_, sizeof(batch_header_)),
+            strand_.wrap(
+                boost::bind(&session::handle_read_batch_header
+                          , shared_from_this()
+                          , asio::placeholders::error)));
+}
+
+void session::handle_read_batch_header(error_code const& error)
+{
+    if (error) return finish(error);
+
+    if (  batch_header_.count == 0
+       || batch_header_.count > batch_header::max_count)
+    {
+        std::cerr << "rejecting batch of " << batch_header_.count
+                  << " coordinates\n";
+        return finish();
+    }
+
+    // Buffers are reused, so this only allocates while they are growing.
+    in_buffer_->resize(batch_header_.count);
+
+    asio::async_read(socket_,
+        asio::buffer(in_buffer_->data()
+                   , in_buffer_->size() * sizeof(coordinate)),
+            strand_.wrap(
+                boost::bind(&session::handle_read_batch
+                          , shared_from_this()
+                          , asio::placeholders::error)));
+}
+
+void session::handle_read_batch(error_code const& error)
+{
+    if (error) return finish(error);
+
+    std::shared_ptr<batch_buffer> buffer;
+    std::swap(buffer, in_buffer_);
+
+    server_.get_workers().post(
+        boost::bind(&session::process, shared_from_this(), buffer));
+
+    // Start reading the next batch while this one is processed.
+    async_read_batch_header();
+}
+
+void session::process(std::shared_ptr<batch_buffer> buffer)
+{
+    server_.stats.checksum += process_batch(*buffer);
+    server_.stats.coordinates += buffer->size();
+    ++server_.stats.batches;
+
+    strand_.post(boost::bind(&session::release, shared_from_this(), buffer));
+}
+
+void session::release(std::shared_ptr<batch_buffer> buffer)
+{
+    free_buffers_.push_back(buffer);
+
+    if (paused_)
+    {
+        paused_ = false;
+        async_read_batch_header();
+    }
+}
+
+// Called once, when we stop reading from the client. Batches still with the
+// workers hold on to the session until they are done.
+void session::finish(error_code const& error)
+{
+    if (error && error != asio::error::eof)
+        std::cerr << "client error: " << error.message() << "\n";
+
+    server_.client_done();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void report(
+    ingest_stats const& stats
+  , boost::uint64_t coordinates
+  , double seconds
+    )
+{
+    double mb = double(coordinates * sizeof(coordinate)) / (1024 * 1024);
+
+    std::cout << "clients: " << stats.clients_active.load()
+              << "  coordinates/s: " << (coordinates / seconds)
+              << "  MB/s: " << (mb / seconds) << "\n";
+}
+
+struct reporter
+{
+  private:
+    asio::steady_timer timer_;
+    std::chrono::milliseconds interval_;
+    ingest_stats const& stats_;
+    boost::uint64_t last_coordinates_;
+    clock_type::time_point last_time_;
+
+  public:
+    reporter(
+        asio::io_service& io_service
+      , std::chrono::milliseconds interval
+      , ingest_stats const& stats
+        )
+      : timer_(io_service)
+      , interval_(interval)
+      , stats_(stats)
+      , last_coordinates_(0)
+      , last_time_(clock_type::now())
+    {
+        async_wait();
+    }
+
+    void cancel()
+    {
+        timer_.cancel();
+    }
 
-    acceptor.accept(*s.rdbuf());
+  private:
+    void async_wait()
+    {
+        timer_.expires_from_now(interval_);
+        timer_.async_wait(boost::bind(&reporter::handle_wait
+                                    , this
+                                    , asio::placeholders::error));
+    }
 
+    void handle_wait(error_code const& error)
     {
-        boost::archive::binary_iarchive la(s);
+        if (error) return;
+
+        clock_type::time_point now = clock_type::now();
+        boost::uint64_t coordinates = stats_.coordinates.load();
+
+        // Only report intervals in which something happened.
+        if (coordinates != last_coordinates_)
+            report(stats_, coordinates - last_coordinates_
+                 , std::chrono::duration<double>(now - last_time_).count());
+
+        last_coordinates_ = coordinates;
+        last_time_ = now;
+
+        async_wait();
+    }
+};
+
+int main(int argc, char** argv)
+{
+    // Parse command line.
+    po::variables_map vm;
+
+    po::options_description
+        cmdline("Usage: ot_server [--port <port>] [--io-threads <n>]"
+                " [--workers <n>] [--window <n>] [--clients <n>]");
+
+    unsigned cores = std::max(1u, std::thread::hardware_concurrency());
+
+    cmdline.add_options()
+        ( "help,h"
+        , "print out program usage (this message)")
+
+        ( "port"
+        , po::value<unsigned short>()->default_value(2000)
+        , "TCP port to listen on")
+
+        ( "io-threads"
+        , po::value<unsigned>()->default_value(1)
+        , "number of threads running the sockets")
+
+        ( "workers"
+        , po::value<unsigned>()->default_value(cores)
+        , "number of threads processing batches")
+
+        ( "window"
+        , po::value<std::size_t>()->default_value(4)
+        , "number of batches buffered per client")
+
+        ( "clients"
+        , po::value<boost::uint64_t>()->default_value(0)
+        , "exit after this many clients have disconnected (0 means never)")
+
+        ( "report-interval"
+        , po::value<unsigned>()->default_value(1000)
+        , "milliseconds between throughput reports")
+    ;
+
+    po::store(po::command_line_parser(argc, argv).options(cmdline).run(), vm);
 
-        coordinate c;
-        la >> c;
+    po::notify(vm);
 
-        std::cout << "{" << c.x << ", " << c.y << "}\n";
+    // Print help screen.
+    if (vm.count("help"))
+    {
+        std::cout << cmdline;
+        return 1;
     }
+
+    unsigned io_threads = std::max(1u, vm["io-threads"].as<unsigned>());
+    unsigned workers = std::max(1u, vm["workers"].as<unsigned>());
+    std::size_t window =
+        std::max<std::size_t>(1, vm["window"].as<std::size_t>());
+
+    asio::io_service io_service;
+    asio::io_service worker_service;
+
+    std::unique_ptr<asio::io_service::work>
+        worker_work(new asio::io_service::work(worker_service));
+
+    server srv(io_service
+             , worker_service
+             , vm["port"].as<unsigned short>()
+             , window
+             , vm["clients"].as<boost::uint64_t>());
+
+    reporter rep(io_service
+               , std::chrono::milliseconds(vm["report-interval"].as<unsigned>())
+               , srv.stats);
+
+    asio::signal_set signals(io_service, SIGINT, SIGTERM);
+    signals.async_wait(boost::bind(&asio::io_service::stop, &io_service));
+
+    clock_type::time_point start = clock_type::now();
+
+    std::vector<std::thread> worker_threads;
+
+    for (unsigned i = 0; i < workers; ++i)
+        worker_threads.emplace_back(
+            boost::bind(&asio::io_service::run, &worker_service));
+
+    std::vector<std::thread> threads;
+
+    for (unsigned i = 0; i < io_threads; ++i)
+        threads.emplace_back(
+            boost::bind(&asio::io_service::run, &io_service));
+
+    for (std::thread& t : threads)
+        t.join();
+
+    // The I/O threads have stopped; let the workers drain what's queued.
+    worker_work.reset();
+
+    for (std::thread& t : worker_threads)
+        t.join();
+
+    double seconds =
+        std::chrono::duration<double>(clock_type::now() - start).count();
+
+    std::cout << "total: " << srv.stats.coordinates.load() << " coordinates in "
+              << srv.stats.batches.load() << " batches from "
+              << srv.stats.clients_done.load() << " clients, checksum "
+              << srv.stats.checksum.load() << "\n";
+
+    report(srv.stats, srv.stats.coordinates.load(), seconds);
+
+    return 0;
 }
 
@@ -0,0 +1,452 @@
+// Copyright (c) 2012-2013 Bryce Adelstein-Lelbach
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+#if !defined(CPPNOW_5C41A63D_D54D_421C_9A08_6309B70E854C)
+#define CPPNOW_5C41A63D_D54D_421C_9A08_6309B70E854C
+
+#include <clocale>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <limits>
+#include <type_traits>
+#include <vector>
+
+#include <boost/cstdint.hpp>
+#include <boost/mpl/bool.hpp>
+#include <boost/archive/archive_exception.hpp>
+#include <boost/serialization/nvp.hpp>
+#include <boost/serialization/version.hpp>
+#include <boost/serialization/serialization.hpp>
+
+namespace fast_text_detail
+{
+
+/// The decimal digits of 00 through 99, two characters each. Formatting
+/// two digits per division halves the number of (slow) divisions.
+inline char const* digit_pairs()
+{
+    return "00010203040506070809"
+           "10111213141516171819"
+           "20212223242526272829"
+           "30313233343536373839"
+           "40414243444546474849"
+           "50515253545556575859"
+           "60616263646566676869"
+           "70717273747576777879"
+           "80818283848586878889"
+           "90919293949596979899";
+}
+
+/// Writes the decimal representation of v so that it ends just before last,
+/// and returns its first character. last must have at least 20 characters
+/// in front of it.
+inline char* format_unsigned(boost::uint64_t v, char* last)
+{
+    char const* pairs = digit_pairs();
+
+    while (v >= 100)
+    {
+        unsigned i = static_cast<unsigned>(v % 100) * 2;
+        v /= 100;
+        *--last = pairs[i + 1];
+        *--last = pairs[i];
+    }
+
+    if (v >= 10)
+    {
+        unsigned i = static_cast<unsigned>(v) * 2;
+        *--last = pairs[i + 1];
+        *--last = pairs[i];
+    }
+    else
+        *--last = static_cast<char>('0' + v);
+
+    return last;
+}
+
+/// The decimal point snprintf and strtod use in the current C locale. Our
+/// text always uses '.', so it's swapped in and out around those calls.
+inline char locale_decimal_point()
+{
+    char const* point = std::localeconv()->decimal_point;
+    return (point && *point) ? *point : '.';
+}
+
+/// The type whose range a value of type T must fit into: the underlying
+/// type of an enumeration, or T itself.
+template <typename T, bool IsEnum = std::is_enum<T>::value>
+struct value_type
+{
+    typedef T type;
+};
+
+template <typename T>
+struct value_type<T, true>
+{
+    typedef typename std::underlying_type<T>::type type;
+};
+
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// A text archive for plain data which, unlike boost::archive::text_oarchive,
+/// does not go through iostreams. Integers are formatted by hand (no locale,
+/// no stream state, no virtual calls) and appended to a std::vector<char>,
+/// each followed by a single space, so the output is still readable:
+///
+///     17 42
+///
+/// Floating point values are written with "%.17g", which round-trips, and
+/// always with a '.' as the decimal point, whatever the current locale.
+///
+/// Like varint_archive, there is no archive header and no class metadata;
+/// objects are written as the plain sequence of their members.
+struct fast_text_oarchive
+{
+    typedef boost::mpl::bool_<true> is_saving;
+    typedef boost::mpl::bool_<false> is_loading;
+
+  private:
+    std::vector<char>& buffer_;
+
+  public:
+    explicit fast_text_oarchive(std::vector<char>& buffer)
+      : buffer_(buffer)
+    {}
+
+    template <typename T>
+    fast_text_oarchive& operator<<(T const& t)
+    {
+        save(t, category<T>());
+        return *this;
+    }
+
+    template <typename T>
+    fast_text_oarchive& operator&(T const& t)
+    {
+        return *this << t;
+    }
+
+    template <typename T>
+    void register_type(T const* = 0) {}
+
+    unsigned int get_library_version() const
+    {
+        return 0;
+    }
+
+    void save_unsigned(boost::uint64_t v, bool negative = false)
+    {
+        // 20 digits, a sign and the separator.
+        char text[22];
+        char* last = text + sizeof(text);
+
+        *--last = ' ';
+        char* first = fast_text_detail::format_unsigned(v, last);
+
+        if (negative)
+            *--first = '-';
+
+        buffer_.insert(buffer_.end(), first, text + sizeof(text));
+    }
+
+  private:
+    struct unsigned_tag {};
+    struct signed_tag {};
+    struct floating_tag {};
+    struct class_tag {};
+
+    template <typename T>
+    struct category
+      : std::conditional<std::is_enum<T>::value
+          , signed_tag
+          , typename std::conditional<std::is_floating_point<T>::value
+              , floating_tag
+              , typename std::conditional<std::is_signed<T>::value
+                  , signed_tag
+                  , typename std::conditional<std::is_integral<T>::value
+                      , unsigned_tag
+                      , class_tag
+                    >::type
+                >::type
+            >::type
+        >::type
+    {};
+
+    template <typename T>
+    void save(T const& t, unsigned_tag)
+    {
+        save_unsigned(static_cast<boost::uint64_t>(t));
+    }
+
+    template <typename T>
+    void save(T const& t, signed_tag)
+    {
+        boost::int64_t v = static_cast<boost::int64_t>(t);
+
+        // Negate in unsigned arithmetic, so that INT64_MIN works.
+        if (v < 0)
+            save_unsigned(0 - static_cast<boost::uint64_t>(v), true);
+        else
+            save_unsigned(static_cast<boost::uint64_t>(v));
+    }
+
+    template <typename T>
+    void save(T const& t, floating_tag)
+    {
+        char text[32];
+        int size = std::snprintf(text, sizeof(text), "%.17g "
+                               , static_cast<double>(t));
+
+        char const point = fast_text_detail::locale_decimal_point();
+        if (point != '.')
+            std::replace(text, text + size, point, '.');
+
+        buffer_.insert(buffer_.end(), text, text + size);
+    }
+
+    template <typename T>
+    void save(boost::serialization::nvp<T> const& t, class_tag)
+    {
+        *this << t.const_value();
+    }
+
+    template <typename T>
+    void save(T const& t, class_tag)
+    {
+        boost::serialization::serialize_adl(*this, const_cast<T&>(t)
+          , boost::serialization::version<T>::value);
+    }
+};
+
+///////////////////////////////////////////////////////////////////////////////
+/// Reads what fast_text_oarchive wrote from a contiguous buffer. Values may
+/// be separated by any amount of whitespace, so hand-edited input works
+/// too. Throws archive_exception::input_stream_error if the buffer runs out
+/// or a value is malformed or out of range.
+struct fast_text_iarchive
+{
+    typedef boost::mpl::bool_<false> is_saving;
+    typedef boost::mpl::bool_<true> is_loading;
+
+  private:
+    char const* first_;
+    char const* last_;
+
+  public:
+    fast_text_iarchive(char const* first, char const* last)
+      : first_(first)
+      , last_(last)
+    {}
+
+    explicit fast_text_iarchive(std::vector<char> const& buffer)
+      : first_(buffer.data())
+      , last_(buffer.data() + buffer.size())
+    {}
+
+    template <typename T>
+    fast_text_iarchive& operator>>(T& t)
+    {
+        load(t, category<T>());
+        return *this;
+    }
+
+    template <typename T>
+    fast_text_iarchive& operator>>(boost::serialization::nvp<T> const& t)
+    {
+        return *this >> t.value();
+    }
+
+    template <typename T>
+    fast_text_iarchive& operator&(T& t)
+    {
+        return *this >> t;
+    }
+
+    template <typename T>
+    fast_text_iarchive& operator&(boost::serialization::nvp<T> const& t)
+    {
+        return *this >> t.value();
+    }
+
+    template <typename T>
+    void register_type(T const* = 0) {}
+
+    unsigned int get_library_version() const
+    {
+        return 0;
+    }
+
+    void reset_object_address(void const*, void const*) {}
+
+    /// Parses an unsigned decimal integer. If negative is non-null, a
+    /// leading '-' is accepted and reported through it.
+    boost::uint64_t load_unsigned(bool* negative = 0)
+    {
+        skip_whitespace();
+
+        if (negative)
+        {
+            *negative = (first_ != last_) && (*first_ == '-');
+            if (*negative)
+                ++first_;
+        }
+
+        char const* start = first_;
+        boost::uint64_t v = 0;
+
+        // Up to 19 digits can't overflow, so we only check the 20th.
+        char const* fast_last =
+            (last_ - first_ > 19) ? (first_ + 19) : last_;
+
+        unsigned digit = 0;
+        while (first_ != fast_last
+            && (digit = unsigned(*first_) - unsigned('0')) < 10)
+        {
+            v = v * 10 + digit;
+            ++first_;
+        }
+
+        if (first_ == start)
+            malformed();
+
+        if (first_ != last_
+            && (digit = unsigned(*first_) - unsigned('0')) < 10)
+        {
+            boost::uint64_t const max = ~boost::uint64_t(0);
+
+            if (first_ - start != 19 || v > (max - digit) / 10)
+                malformed();
+
+            v = v * 10 + digit;
+            ++first_;
+
+            if (first_ != last_ && unsigned(*first_) - unsigned('0') < 10)
+                malformed();
+        }
+
+        return v;
+    }
+
+  private:
+    static void malformed()
+    {
+        throw boost::archive::archive_exception(
+            boost::archive::archive_exception::input_stream_error);
+    }
+
+    void skip_whitespace()
+    {
+        while (first_ != last_ && (*first_ == ' ' || *first_ == '\n'
+                                || *first_ == '\t' || *first_ == '\r'))
+            ++first_;
+    }
+
+    struct unsigned_tag {};
+    struct signed_tag {};
+    struct floating_tag {};
+    struct class_tag {};
+
+    template <typename T>
+    struct category
+      : std::conditional<std::is_enum<T>::value
+          , signed_tag
+          , typename std::conditional<std::is_floating_point<T>::value
+              , floating_tag
+              , typename std::conditional<std::is_signed<T>::value
+                  , signed_tag
+                  , typename std::conditional<std::is_integral<T>::value
+                      , unsigned_tag
+                      , class_tag
+                    >::type
+                >::type
+            >::type
+        >::type
+    {};
+
+    template <typename T>
+    void load(T& t, unsigned_tag)
+    {
+        boost::uint64_t v = load_unsigned();
+
+        // T itself, not just uint64_t, must be able to hold the value.
+        if (v > boost::uint64_t(std::numeric_limits<T>::max()))
+            malformed();
+
+        t = static_cast<T>(v);
+    }
+
+    template <typename T>
+    void load(T& t, signed_tag)
+    {
+        typedef typename fast_text_detail::value_type<T>::type value_type;
+
+        bool negative = false;
+        boost::uint64_t v = load_unsigned(&negative);
+
+        // The magnitude has to fit into T (or the underlying type of an
+        // enumeration), not just into int64_t. The most negative value of a
+        // two's complement type is one further from 0 than the largest.
+        boost::uint64_t const max
+            = boost::uint64_t(std::numeric_limits<value_type>::max());
+
+        boost::uint64_t const limit = !negative ? max
+            : (std::is_signed<value_type>::value ? max + 1 : 0);
+
+        if (v > limit)
+            malformed();
+
+        boost::int64_t s = negative
+            ? static_cast<boost::int64_t>(0 - v)
+            : static_cast<boost::int64_t>(v);
+
+        t = static_cast<T>(s);
+    }
+
+    template <typename T>
+    void load(T& t, floating_tag)
+    {
+        skip_whitespace();
+
+        // strtod needs a terminator; no number we write is longer than this.
+        char text[32];
+        std::size_t size = std::size_t(last_ - first_);
+        if (size > sizeof(text) - 1)
+            size = sizeof(text) - 1;
+        std::memcpy(text, first_, size);
+        text[size] = '\0';
+
+        // strtod expects the decimal point of the current locale, and would
+        // accept that locale's point where we only allow '.'.
+        char const point = fast_text_detail::locale_decimal_point();
+        if (point != '.')
+        {
+            char* stop = std::find(text, text + size, point);
+            *stop = '\0';
+            std::replace(text, stop, '.', point);
+        }
+
+        char* end = 0;
+        double v = std::strtod(text, &end);
+
+        if (end == text)
+            malformed();
+
+        first_ += end - text;
+        t = static_cast<T>(v);
+    }
+
+    template <typename T>
+    void load(T& t, class_tag)
+    {
+        boost::serialization::serialize_adl(*this, t
+          , boost::serialization::version<T>::value);
+    }
+};
+
+#endif
+
@@ -0,0 +1,193 @@
+// Copyright (c) 2012-2013 Bryce Adelstein-Lelbach
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+// Compares the cost of round-tripping large batches of coordinates through
+// the text, XML and binary Boost archives and through our own varint and
+// fast text archives.
+//
+// Usage: serialization_benchmark [count]
+
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <boost/cstdint.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/archive/text_iarchive.hpp>
+#include <boost/archive/text_oarchive.hpp>
+#include <boost/archive/xml_iarchive.hpp>
+#include <boost/archive/xml_oarchive.hpp>
+#include <boost/archive/binary_iarchive.hpp>
+#include <boost/archive/binary_oarchive.hpp>
+
+#include "varint_archive.hpp"
+#include "fast_text_archive.hpp"
+
+struct coordinate
+{
+    boost::uint64_t x;
+    boost::uint64_t y;
+
+    template <typename Archive>
+    void serialize(Archive& ar, const unsigned)
+    {
+        ar & BOOST_SERIALIZATION_NVP(x);
+        ar & BOOST_SERIALIZATION_NVP(y);
+    }
+};
+
+typedef std::chrono::high_resolution_clock clock_type;
+
+double seconds_since(clock_type::time_point start)
+{
+    return std::chrono::duration<double>(clock_type::now() - start).count();
+}
+
+void report(
+    std::string const& name
+  , std::vector<coordinate> const& in
+  , std::vector<coordinate> const& out
+  , double save_time
+  , double load_time
+  , std::size_t bytes
+    )
+{
+    bool ok = in.size() == out.size();
+    for (std::size_t i = 0; ok && i < in.size(); ++i)
+        ok = (in[i].x == out[i].x) && (in[i].y == out[i].y);
+
+    double n = double(in.size());
+
+    std::cout << std::left << std::setw(8) << name << std::right
+              << std::fixed << std::setprecision(1)
+              << std::setw(12) << (save_time * 1e9 / n)
+              << std::setw(12) << (load_time * 1e9 / n)
+              << std::setw(14) << (double(bytes) / n)
+              << (ok ? "" : "  MISMATCH") << "\n";
+}
+
+template <typename OArchive, typename IArchive>
+void benchmark_boost_archive(
+    std::string const& name
+  , std::vector<coordinate> const& in
+    )
+{
+    std::stringstream ss;
+
+    clock_type::time_point start = clock_type::now();
+
+    {
+        OArchive sa(ss);
+
+        for (coordinate const& c : in)
+            sa << BOOST_SERIALIZATION_NVP(c);
+    }
+
+    double save_time = seconds_since(start);
+
+    std::size_t bytes = ss.str().size();
+
+    std::vector<coordinate> out(in.size());
+
+    start = clock_type::now();
+
+    {
+        IArchive la(ss);
+
+        for (coordinate& c : out)
+            la >> BOOST_SERIALIZATION_NVP(c);
+    }
+
+    double load_time = seconds_since(start);
+
+    report(name, in, out, save_time, load_time, bytes);
+}
+
+template <typename OArchive, typename IArchive>
+void benchmark_buffer_archive(
+    std::string const& name
+  , std::vector<coordinate> const& in
+    )
+{
+    std::vector<char> buffer;
+
+    clock_type::time_point start = clock_type::now();
+
+    {
+        OArchive sa(buffer);
+
+        for (coordinate const& c : in)
+            sa << c;
+    }
+
+    double save_time = seconds_since(start);
+
+    std::vector<coordinate> out(in.size());
+
+    start = clock_type::now();
+
+    {
+        IArchive la(buffer);
+
+        for (coordinate& c : out)
+            la >> c;
+    }
+
+    double load_time = seconds_since(start);
+
+    report(name, in, out, save_time, load_time, buffer.size());
+}
+
+int main(int argc, char** argv)
+{
+    std::size_t count = 1000000;
+
+    if (argc > 1)
+        count = boost::lexical_cast<std::size_t>(argv[1]);
+
+    // Most of our coordinates are small, so that's what we test with.
+    std::mt19937_64 gen(42);
+    std::uniform_int_distribution<boost::uint64_t> dist(0, 100000);
+
+    std::vector<coordinate> in(count);
+    for (coordinate& c : in)
+    {
+        c.x = dist(gen);
+        c.y = dist(gen);
+    }
+
+    std::cout << count << " coordinates\n"
+              << std::left << std::setw(8) << "archive" << std::right
+              << std::setw(12) << "save ns/obj"
+              << std::setw(12) << "load ns/obj"
+              << std::setw(14) << "bytes/obj" << "\n";
+
+    benchmark_boost_archive<
+        boost::archive::text_oarchive, boost::archive::text_iarchive
+    >("text", in);
+
+    benchmark_boost_archive<
+        boost::archive::xml_oarchive, boost::archive::xml_iarchive
+    >("xml", in);
+
+    benchmark_boost_archive<
+        boost::archive::binary_oarchive, boost::archive::binary_iarchive
+    >("binary", in);
+
+    benchmark_buffer_archive<
+        varint_oarchive, varint_iarchive
+    >("varint", in);
+
+    benchmark_buffer_archive<
+        fast_text_oarchive, fast_text_iarchive
+    >("fasttext", in);
+
+    return 0;
+}
+
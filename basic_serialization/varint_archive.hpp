@@ -0,0 +1,335 @@
+// Copyright (c) 2012-2013 Bryce Adelstein-Lelbach
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+#if !defined(CPPNOW_4CB48CA2_920B_40BC_9C92_DB91C0D2E4EF)
+#define CPPNOW_4CB48CA2_920B_40BC_9C92_DB91C0D2E4EF
+
+#include <cstring>
+#include <limits>
+#include <type_traits>
+#include <vector>
+
+#include <boost/cstdint.hpp>
+#include <boost/mpl/bool.hpp>
+#include <boost/archive/archive_exception.hpp>
+#include <boost/serialization/nvp.hpp>
+#include <boost/serialization/version.hpp>
+#include <boost/serialization/serialization.hpp>
+
+namespace varint_detail
+{
+
+/// The type whose range a value of type T must fit into: the underlying
+/// type of an enumeration, or T itself.
+template <typename T, bool IsEnum = std::is_enum<T>::value>
+struct value_type
+{
+    typedef T type;
+};
+
+template <typename T>
+struct value_type<T, true>
+{
+    typedef typename std::underlying_type<T>::type type;
+};
+
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// A compact archive for plain data. Unsigned integers are written as
+/// LEB128 varints (7 bits per byte, so values below 128 take one byte), and
+/// signed integers are zigzag encoded first, so that small negative values
+/// stay small too. Floating point values are written as raw bytes.
+///
+/// Unlike the Boost archives, there is no archive header and no class
+/// metadata (versions, tracking, pointers); objects are written as the plain
+/// sequence of their members. This makes it unsuitable for polymorphic or
+/// versioned types, but it is what you want for bulk data like coordinates.
+struct varint_oarchive
+{
+    typedef boost::mpl::bool_<true> is_saving;
+    typedef boost::mpl::bool_<false> is_loading;
+
+  private:
+    std::vector<char>& buffer_;
+
+  public:
+    explicit varint_oarchive(std::vector<char>& buffer)
+      : buffer_(buffer)
+    {}
+
+    template <typename T>
+    varint_oarchive& operator<<(T const& t)
+    {
+        save(t, category<T>());
+        return *this;
+    }
+
+    template <typename T>
+    varint_oarchive& operator&(T const& t)
+    {
+        return *this << t;
+    }
+
+    template <typename T>
+    void register_type(T const* = 0) {}
+
+    unsigned int get_library_version() const
+    {
+        return 0;
+    }
+
+    void save_binary(void const* p, std::size_t size)
+    {
+        char const* first = static_cast<char const*>(p);
+        buffer_.insert(buffer_.end(), first, first + size);
+    }
+
+    void save_varint(boost::uint64_t v)
+    {
+        while (v >= 0x80)
+        {
+            buffer_.push_back(static_cast<char>(v | 0x80));
+            v >>= 7;
+        }
+        buffer_.push_back(static_cast<char>(v));
+    }
+
+  private:
+    struct unsigned_tag {};
+    struct signed_tag {};
+    struct floating_tag {};
+    struct class_tag {};
+
+    template <typename T>
+    struct category
+      : std::conditional<std::is_enum<T>::value
+          , signed_tag
+          , typename std::conditional<std::is_floating_point<T>::value
+              , floating_tag
+              , typename std::conditional<std::is_signed<T>::value
+                  , signed_tag
+                  , typename std::conditional<std::is_integral<T>::value
+                      , unsigned_tag
+                      , class_tag
+                    >::type
+                >::type
+            >::type
+        >::type
+    {};
+
+    template <typename T>
+    void save(T const& t, unsigned_tag)
+    {
+        save_varint(static_cast<boost::uint64_t>(t));
+    }
+
+    template <typename T>
+    void save(T const& t, signed_tag)
+    {
+        boost::int64_t v = static_cast<boost::int64_t>(t);
+        save_varint((static_cast<boost::uint64_t>(v) << 1)
+                  ^ static_cast<boost::uint64_t>(v >> 63));
+    }
+
+    template <typename T>
+    void save(T const& t, floating_tag)
+    {
+        save_binary(&t, sizeof(t));
+    }
+
+    template <typename T>
+    void save(boost::serialization::nvp<T> const& t, class_tag)
+    {
+        *this << t.const_value();
+    }
+
+    template <typename T>
+    void save(T const& t, class_tag)
+    {
+        boost::serialization::serialize_adl(*this, const_cast<T&>(t)
+          , boost::serialization::version<T>::value);
+    }
+};
+
+///////////////////////////////////////////////////////////////////////////////
+/// Reads what varint_oarchive wrote from a contiguous buffer. Throws
+/// archive_exception::input_stream_error if the buffer runs out.
+struct varint_iarchive
+{
+    typedef boost::mpl::bool_<false> is_saving;
+    typedef boost::mpl::bool_<true> is_loading;
+
+  private:
+    char const* first_;
+    char const* last_;
+
+  public:
+    varint_iarchive(char const* first, char const* last)
+      : first_(first)
+      , last_(last)
+    {}
+
+    explicit varint_iarchive(std::vector<char> const& buffer)
+      : first_(buffer.data())
+      , last_(buffer.data() + buffer.size())
+    {}
+
+    template <typename T>
+    varint_iarchive& operator>>(T& t)
+    {
+        load(t, category<T>());
+        return *this;
+    }
+
+    template <typename T>
+    varint_iarchive& operator>>(boost::serialization::nvp<T> const& t)
+    {
+        return *this >> t.value();
+    }
+
+    template <typename T>
+    varint_iarchive& operator&(T& t)
+    {
+        return *this >> t;
+    }
+
+    template <typename T>
+    varint_iarchive& operator&(boost::serialization::nvp<T> const& t)
+    {
+        return *this >> t.value();
+    }
+
+    template <typename T>
+    void register_type(T const* = 0) {}
+
+    unsigned int get_library_version() const
+    {
+        return 0;
+    }
+
+    void reset_object_address(void const*, void const*) {}
+
+    void load_binary(void* p, std::size_t size)
+    {
+        if (std::size_t(last_ - first_) < size)
+            underflow();
+        std::memcpy(p, first_, size);
+        first_ += size;
+    }
+
+    boost::uint64_t load_varint()
+    {
+        boost::uint64_t v = 0;
+
+        for (unsigned shift = 0; shift < 64; shift += 7)
+        {
+            if (first_ == last_)
+                underflow();
+
+            boost::uint64_t byte = static_cast<unsigned char>(*first_++);
+
+            // The 10th byte only has room for the top bit of a 64 bit value.
+            if (shift == 63 && byte > 1)
+                malformed();
+
+            v |= (byte & 0x7F) << shift;
+
+            if (!(byte & 0x80))
+                return v;
+        }
+
+        // More than 10 bytes; this isn't a varint we wrote.
+        malformed();
+        return 0;
+    }
+
+  private:
+    static void underflow()
+    {
+        throw boost::archive::archive_exception(
+            boost::archive::archive_exception::input_stream_error);
+    }
+
+    static void malformed()
+    {
+        throw boost::archive::archive_exception(
+            boost::archive::archive_exception::input_stream_error);
+    }
+
+    struct unsigned_tag {};
+    struct signed_tag {};
+    struct floating_tag {};
+    struct class_tag {};
+
+    template <typename T>
+    struct category
+      : std::conditional<std::is_enum<T>::value
+          , signed_tag
+          , typename std::conditional<std::is_floating_point<T>::value
+              , floating_tag
+              , typename std::conditional<std::is_signed<T>::value
+                  , signed_tag
+                  , typename std::conditional<std::is_integral<T>::value
+                      , unsigned_tag
+                      , class_tag
+                    >::type
+                >::type
+            >::type
+        >::type
+    {};
+
+    template <typename T>
+    void load(T& t, unsigned_tag)
+    {
+        boost::uint64_t v = load_varint();
+
+        if (v > boost::uint64_t(std::numeric_limits<T>::max()))
+            malformed();
+
+        t = static_cast<T>(v);
+    }
+
+    template <typename T>
+    void load(T& t, signed_tag)
+    {
+        typedef typename varint_detail::value_type<T>::type value_type;
+        typedef std::numeric_limits<value_type> limits;
+
+        boost::uint64_t v = load_varint();
+        boost::int64_t s = static_cast<boost::int64_t>(v >> 1)
+                         ^ -static_cast<boost::int64_t>(v & 1);
+
+        // Values are saved through int64_t, so any value fits into a 64 bit
+        // unsigned (underlying) type.
+        bool const fits = limits::is_signed
+            ? (  s >= boost::int64_t(limits::min())
+              && s <= boost::int64_t(limits::max()))
+            : (  sizeof(value_type) >= sizeof(boost::int64_t)
+              || (  s >= 0
+                 && boost::uint64_t(s) <= boost::uint64_t(limits::max())));
+
+        if (!fits)
+            malformed();
+
+        t = static_cast<T>(s);
+    }
+
+    template <typename T>
+    void load(T& t, floating_tag)
+    {
+        load_binary(&t, sizeof(t));
+    }
+
+    template <typename T>
+    void load(T& t, class_tag)
+    {
+        boost::serialization::serialize_adl(*this, t
+          , boost::serialization::version<T>::value);
+    }
+};
+
+#endif
+